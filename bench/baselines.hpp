@@ -0,0 +1,218 @@
+#ifndef INDEX_TABLE_BASELINES
+#define INDEX_TABLE_BASELINES
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <unordered_map>
+#include <utility>
+
+/*
+    Baseline containers for the benchmarks, each with the index_table interface the benchmarks
+    use: insert, geti, gett, removei, removet and count. Lookups of missing indices return T(),
+    and searches by item return npos. Only the benchmarks use them.
+*/
+
+/*
+    std::unordered_map from a counter to the item, the counter is handed back as the index.
+    Searching by item visits every entry, like index_table without reverse_lookup.
+*/
+template<typename T>
+class map_baseline {
+    std::unordered_map<uint64_t, T> items;
+    uint64_t next = 0;
+
+    public:
+    static constexpr uint64_t npos = ~uint64_t(0);
+
+    map_baseline(int32_t cache) { items.reserve(cache); }
+
+    uint64_t insert(const T& item) {
+        items.emplace(next, item);
+        return next++;
+    }
+
+    T geti(uint64_t index) {
+        auto it = items.find(index);
+        return (it == items.end()) ? T() : it->second;
+    }
+
+    uint64_t gett(const T& item) {
+        for (auto& [index, held] : items)
+            if (held == item)
+                return index;
+        return npos;
+    }
+
+    T removei(uint64_t index) {
+        auto it = items.find(index);
+        if (it == items.end())
+            return T();
+        T item = std::move(it->second);
+        items.erase(it);
+        return item;
+    }
+
+    uint64_t removet(const T& item) {
+        uint64_t index = gett(item);
+        if (index != npos)
+            items.erase(index);
+        return index;
+    }
+
+    size_t count() { return items.size(); }
+};
+
+/*
+    std::vector of items with an intrusive free list of removed indices, the newest removed index
+    is re-used first. Indices are never shifted, so they stay valid like index_table's.
+*/
+template<typename T>
+class free_list_baseline {
+    std::vector<T> items;
+    // Per index, live while it holds an item, else the next free index or -1.
+    std::vector<int32_t> next;
+    int32_t free_head = -1;
+    size_t filled = 0;
+    static constexpr int32_t live = -2;
+
+    public:
+    static constexpr int32_t npos = -1;
+
+    free_list_baseline(int32_t cache) {
+        items.reserve(cache);
+        next.reserve(cache);
+    }
+
+    int32_t insert(const T& item) {
+        int32_t index = free_head;
+        if (index >= 0) {
+            free_head = next[index];
+            items[index] = item;
+            next[index] = live;
+        } else {
+            index = static_cast<int32_t>(items.size());
+            items.push_back(item);
+            next.push_back(live);
+        }
+        filled++;
+        return index;
+    }
+
+    T geti(int32_t index) {
+        return (index >= 0 && static_cast<size_t>(index) < items.size() && next[index] == live) ? items[index] : T();
+    }
+
+    int32_t gett(const T& item) {
+        for (size_t i = 0; i < items.size(); i++)
+            if (next[i] == live && items[i] == item)
+                return static_cast<int32_t>(i);
+        return npos;
+    }
+
+    T removei(int32_t index) {
+        if (index < 0 || static_cast<size_t>(index) >= items.size() || next[index] != live)
+            return T();
+        T item = std::move(items[index]);
+        items[index] = T();
+        next[index] = free_head;
+        free_head = index;
+        filled--;
+        return item;
+    }
+
+    int32_t removet(const T& item) {
+        int32_t index = gett(item);
+        if (index != npos)
+            removei(index);
+        return index;
+    }
+
+    size_t count() { return filled; }
+};
+
+/*
+    Slot map: items are kept densely packed and each index is a slot number with a generation in
+    the upper 32 bits. Removal moves the last item into the hole, so searching by item scans a
+    contiguous array, and a removed index is never mistaken for the item that re-uses its slot.
+*/
+template<typename T>
+class slot_map_baseline {
+    struct slot {
+        // Position of the item in <values>, or the next free slot while the slot is empty.
+        uint32_t dense;
+        // Odd while the slot holds an item.
+        uint32_t generation;
+    };
+
+    std::vector<slot> slots;
+    std::vector<T> values;
+    // Slot of every item in <values>.
+    std::vector<uint32_t> owners;
+    uint32_t free_head = ~uint32_t(0);
+
+    bool valid(uint64_t index) {
+        uint32_t s = static_cast<uint32_t>(index);
+        return s < slots.size() && slots[s].generation == static_cast<uint32_t>(index >> 32) && (slots[s].generation & 1) != 0;
+    }
+
+    public:
+    static constexpr uint64_t npos = ~uint64_t(0);
+
+    slot_map_baseline(int32_t cache) {
+        slots.reserve(cache);
+        values.reserve(cache);
+        owners.reserve(cache);
+    }
+
+    uint64_t insert(const T& item) {
+        uint32_t s = free_head;
+        if (s != ~uint32_t(0))
+            free_head = slots[s].dense;
+        else {
+            s = static_cast<uint32_t>(slots.size());
+            slots.push_back({ 0, 0 });
+        }
+        slots[s].generation++;
+        slots[s].dense = static_cast<uint32_t>(values.size());
+        values.push_back(item);
+        owners.push_back(s);
+        return (uint64_t(slots[s].generation) << 32) | s;
+    }
+
+    T geti(uint64_t index) { return valid(index) ? values[slots[static_cast<uint32_t>(index)].dense] : T(); }
+
+    uint64_t gett(const T& item) {
+        for (size_t d = 0; d < values.size(); d++)
+            if (values[d] == item)
+                return (uint64_t(slots[owners[d]].generation) << 32) | owners[d];
+        return npos;
+    }
+
+    T removei(uint64_t index) {
+        if (!valid(index))
+            return T();
+        uint32_t s = static_cast<uint32_t>(index);
+        uint32_t d = slots[s].dense;
+        T item = std::move(values[d]);
+        values[d] = std::move(values.back());
+        owners[d] = owners.back();
+        slots[owners[d]].dense = d;
+        values.pop_back();
+        owners.pop_back();
+        slots[s].generation++;
+        slots[s].dense = free_head;
+        free_head = s;
+        return item;
+    }
+
+    uint64_t removet(const T& item) {
+        uint64_t index = gett(item);
+        if (index != npos)
+            removei(index);
+        return index;
+    }
+
+    size_t count() { return values.size(); }
+};
+
+#endif
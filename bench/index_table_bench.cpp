@@ -0,0 +1,222 @@
+#include "index_table.hpp"
+#include "baselines.hpp"
+#include <benchmark/benchmark.h>
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+/*
+    Benchmarks for index_table against std::unordered_map, a std::vector with a free list and a
+    slot map (bench/baselines.hpp). Every benchmark is registered per container and table size,
+    from 1e3 up to INDEX_BENCH_MAX_ITEMS by powers of ten, and named "<operation>/<container>/<n>":
+    - insert:   bulk load of n items into an empty table.
+    - geti:     lookup of a random index in a table of n items.
+    - gett:     search for a random item, sizes above 1e5 only with reverse_lookup since the others scan.
+    - removei:  steady state churn, removes a random index then re-inserts its item.
+    - removet:  steady state churn by item, same sizes as gett.
+    - count:    in a table of n items.
+    - boundary: inserts one item into a table whose buckets are all full, then removes it again,
+                so every iteration creates and deallocates a bucket unless one is retained.
+    Bucket sizes S of 8, 64, 512 and 4096 are measured with uint64_t items, the payload types
+    uint32_t, uint64_t and a 64 byte struct with S = 64 and against every baseline.
+*/
+
+#ifndef INDEX_BENCH_MAX_ITEMS
+#define INDEX_BENCH_MAX_ITEMS 1000000
+#endif
+
+// Largest table size for searches that scan every item.
+static constexpr int64_t bench_max_scan = 100000;
+
+// 64 byte payload compared by value, T() is never inserted.
+struct payload {
+    uint64_t id;
+    uint64_t data[7];
+    bool operator==(const payload& other) const { return id == other.id; }
+};
+
+template<typename T> T bench_item(uint64_t i);
+template<> uint32_t bench_item<uint32_t>(uint64_t i) { return static_cast<uint32_t>(i + 1); }
+template<> uint64_t bench_item<uint64_t>(uint64_t i) { return i + 1; }
+template<> payload bench_item<payload>(uint64_t i) { return payload{ i + 1, { i, i, i, i, i, i, i } }; }
+
+template<typename C, typename T>
+using bench_index = decltype(std::declval<C&>().insert(std::declval<const T&>()));
+
+// Returns n distinct items in a fixed random order.
+template<typename T>
+std::vector<T> bench_items(size_t n) {
+    std::vector<T> items(n);
+    for (size_t i = 0; i < n; i++)
+        items[i] = bench_item<T>(i);
+    std::shuffle(items.begin(), items.end(), std::mt19937_64(n));
+    return items;
+}
+
+// Returns random positions below n, cycled through by the benchmarks so the generator is not timed.
+std::vector<uint32_t> bench_order(size_t n) {
+    std::vector<uint32_t> order(std::min<size_t>(n, 1 << 16));
+    std::mt19937_64 rng(n + 1);
+    for (auto& pos : order)
+        pos = static_cast<uint32_t>(rng() % n);
+    return order;
+}
+
+// Inserts every item and returns their indices.
+template<typename C, typename T>
+std::vector<bench_index<C, T>> bench_fill(C& table, const std::vector<T>& items) {
+    std::vector<bench_index<C, T>> indices(items.size());
+    for (size_t i = 0; i < items.size(); i++)
+        indices[i] = table.insert(items[i]);
+    return indices;
+}
+
+template<typename C, typename T>
+void bench_insert(benchmark::State& state) {
+    std::vector<T> items = bench_items<T>(state.range(0));
+    for (auto _ : state) {
+        auto table = std::make_unique<C>(0);
+        for (const T& item : items)
+            benchmark::DoNotOptimize(table->insert(item));
+        state.PauseTiming();
+        table.reset();
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * items.size());
+}
+
+template<typename C, typename T>
+void bench_geti(benchmark::State& state) {
+    C table(0);
+    std::vector<T> items = bench_items<T>(state.range(0));
+    std::vector<bench_index<C, T>> indices = bench_fill(table, items);
+    std::vector<uint32_t> order = bench_order(items.size());
+    size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(table.geti(indices[order[i]]));
+        i = (i + 1 == order.size()) ? 0 : i + 1;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+template<typename C, typename T>
+void bench_gett(benchmark::State& state) {
+    C table(0);
+    std::vector<T> items = bench_items<T>(state.range(0));
+    bench_fill(table, items);
+    std::vector<uint32_t> order = bench_order(items.size());
+    size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(table.gett(items[order[i]]));
+        i = (i + 1 == order.size()) ? 0 : i + 1;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+template<typename C, typename T>
+void bench_removei(benchmark::State& state) {
+    C table(0);
+    std::vector<T> items = bench_items<T>(state.range(0));
+    std::vector<bench_index<C, T>> indices = bench_fill(table, items);
+    std::vector<uint32_t> order = bench_order(items.size());
+    size_t i = 0;
+    for (auto _ : state) {
+        uint32_t pos = order[i];
+        T item = table.removei(indices[pos]);
+        indices[pos] = table.insert(item);
+        i = (i + 1 == order.size()) ? 0 : i + 1;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+template<typename C, typename T>
+void bench_removet(benchmark::State& state) {
+    C table(0);
+    std::vector<T> items = bench_items<T>(state.range(0));
+    bench_fill(table, items);
+    std::vector<uint32_t> order = bench_order(items.size());
+    size_t i = 0;
+    for (auto _ : state) {
+        const T& item = items[order[i]];
+        benchmark::DoNotOptimize(table.removet(item));
+        table.insert(item);
+        i = (i + 1 == order.size()) ? 0 : i + 1;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+template<typename C, typename T>
+void bench_count(benchmark::State& state) {
+    C table(0);
+    bench_fill(table, bench_items<T>(state.range(0)));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(table.count());
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+template<typename C, typename T>
+void bench_boundary(benchmark::State& state) {
+    // Rounded up to a multiple of every measured S, so each bucket of the table is full.
+    size_t n = (static_cast<size_t>(state.range(0)) + 4095) / 4096 * 4096;
+    C table(0);
+    bench_fill(table, bench_items<T>(n));
+    T item = bench_item<T>(n);
+    for (auto _ : state) {
+        auto index = table.insert(item);
+        benchmark::DoNotOptimize(table.removei(index));
+    }
+    state.counters["items"] = static_cast<double>(n);
+    state.SetItemsProcessed(state.iterations());
+}
+
+// Registers <fn> once per table size up to <max>.
+template<typename F>
+void bench_register(const std::string& name, F fn, int64_t max) {
+    benchmark::internal::Benchmark* b = benchmark::RegisterBenchmark(name.c_str(), fn);
+    for (int64_t n = 1000; n <= max; n *= 10)
+        b->Arg(n);
+}
+
+// Registers every benchmark for container <C> holding items <T>, <scan> if gett and removet visit every item.
+template<typename C, typename T>
+void bench_container(const std::string& label, bool scan) {
+    int64_t max = INDEX_BENCH_MAX_ITEMS;
+    int64_t search = scan ? std::min(max, bench_max_scan) : max;
+    bench_register("insert/" + label, bench_insert<C, T>, max);
+    bench_register("geti/" + label, bench_geti<C, T>, max);
+    bench_register("gett/" + label, bench_gett<C, T>, search);
+    bench_register("removei/" + label, bench_removei<C, T>, max);
+    bench_register("removet/" + label, bench_removet<C, T>, search);
+    bench_register("count/" + label, bench_count<C, T>, max);
+    bench_register("boundary/" + label, bench_boundary<C, T>, max);
+}
+
+// Registers index_table and every baseline for items <T> with S = 64.
+template<typename T>
+void bench_payload(const std::string& type) {
+    bench_container<index_table<T, 64>, T>("index_table<" + type + ",64>", true);
+    bench_container<map_baseline<T>, T>("unordered_map<" + type + ">", true);
+    bench_container<free_list_baseline<T>, T>("free_list<" + type + ">", true);
+    bench_container<slot_map_baseline<T>, T>("slot_map<" + type + ">", true);
+}
+
+int main(int argc, char** argv) {
+    bench_container<index_table<uint64_t, 8>, uint64_t>("index_table<u64,8>", true);
+    bench_container<index_table<uint64_t, 512>, uint64_t>("index_table<u64,512>", true);
+    bench_container<index_table<uint64_t, 4096>, uint64_t>("index_table<u64,4096>", true);
+    bench_container<index_table<uint64_t, 64, index_options::reverse_lookup>, uint64_t>("index_table<u64,64,reverse_lookup>", false);
+    bench_payload<uint32_t>("u32");
+    bench_payload<uint64_t>("u64");
+    bench_payload<payload>("p64");
+
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv))
+        return 1;
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
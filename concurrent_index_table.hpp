@@ -0,0 +1,682 @@
+#ifndef CONCURRENT_INDEX_TABLE
+#define CONCURRENT_INDEX_TABLE
+/*
+    Concurrent variant of index_table that can be shared between threads without a lock.
+
+    Lookups are wait-free: geti loads the bucket directory, the bucket and the item with
+    plain atomic loads. Inserts and removes claim and release indices with atomic operations
+    on each bucket's occupancy bitmaps. Only creating and deallocating a bucket, which happens
+    once per S inserts or removes at most, takes the table's mutex.
+
+    Deallocated buckets and directories are reclaimed with epoch-based reclamation: every call
+    pins the calling thread's epoch, and memory is freed only once every thread that could
+    still see it has left the table.
+
+    Each thread allocates indices from its own magazine: a batch of indices reserved in one
+    step from a single bucket. Inserts take an index from the magazine without touching shared
+    state, and indices the thread removes from the same bucket go back into the magazine until
+    it is full, after which they are returned to the bucket.
+
+    NOTE: Items are stored as std::atomic<T>, so T must be trivially copyable.
+*/
+#include "index_table.hpp"
+#include <atomic>
+#include <mutex>
+#include <cstdlib>
+
+// Maximum number of threads that may use concurrent tables at the same time.
+#ifndef INDEX_TABLE_MAX_THREADS
+#define INDEX_TABLE_MAX_THREADS 256
+#endif
+
+// Number of indices each thread reserves at once in its per-table magazine.
+#ifndef INDEX_TABLE_MAGAZINE
+#define INDEX_TABLE_MAGAZINE 32
+#endif
+
+// Returns a small id for the calling thread, unique among live threads and re-used after a thread exits.
+inline int32_t index_thread_id() {
+    static std::atomic<bool> used[INDEX_TABLE_MAX_THREADS];
+
+    struct slot {
+        int32_t id = -1;
+        slot() {
+            for (int32_t i = 0; i < INDEX_TABLE_MAX_THREADS; i++) {
+                bool expected = false;
+                if (!used[i].load(std::memory_order_relaxed) && used[i].compare_exchange_strong(expected, true)) {
+                    id = i;
+                    return;
+                }
+            }
+            // More threads than INDEX_TABLE_MAX_THREADS are using concurrent tables.
+            std::abort();
+        }
+        ~slot() { used[id].store(false, std::memory_order_release); }
+    };
+
+    thread_local slot self;
+    return self.id;
+}
+
+/*
+    Epoch-based reclamation for memory that concurrent readers may still reference.
+
+    Readers pin the current global epoch in their thread's record for the duration of a call.
+    Retired memory is tagged with the global epoch and freed once the epoch has advanced twice,
+    which can only happen after every thread pinned at the tagged epoch has unpinned.
+
+    retire() and collect() must be called under the owner's lock; pinning never blocks.
+*/
+class index_epoch {
+    public:
+    // Per-thread epoch the thread is pinned at, else 0 when the thread is not inside the table.
+    struct alignas(64) record {
+        std::atomic<uint64_t> epoch{ 0 };
+    };
+
+    // Pins the calling thread's record for its lifetime. Nested guards on the same thread are no-ops.
+    class guard {
+        record* rec;
+        bool pinned;
+
+        public:
+        guard(index_epoch& owner) : rec(&owner.self()) {
+            pinned = rec->epoch.load(std::memory_order_relaxed) == 0;
+            if (pinned) {
+                rec->epoch.store(owner.global.load(std::memory_order_relaxed), std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+            }
+        }
+
+        ~guard() {
+            if (pinned)
+                rec->epoch.store(0, std::memory_order_release);
+        }
+
+        guard(const guard&) = delete;
+        guard& operator=(const guard&) = delete;
+    };
+
+    private:
+    struct retired {
+        uint64_t epoch;
+        void* ptr;
+        void (*free)(void*);
+    };
+
+    std::atomic<uint64_t> global{ 1 };
+    record records[INDEX_TABLE_MAX_THREADS];
+    std::vector<retired> limbo;
+
+    public:
+    index_epoch() = default;
+    index_epoch(const index_epoch&) = delete;
+    index_epoch& operator=(const index_epoch&) = delete;
+
+    // Frees everything that is still waiting, the owner must be the last user.
+    ~index_epoch() {
+        for (retired& item : limbo)
+            item.free(item.ptr);
+    }
+
+    // Returns the calling thread's record.
+    record& self() { return records[index_thread_id()]; }
+
+    // Queues memory to be freed once no pinned thread can reference it.
+    template<typename P>
+    void retire(P* ptr) {
+        limbo.push_back(retired{ global.load(std::memory_order_relaxed), ptr, [](void* p) { delete static_cast<P*>(p); } });
+        collect();
+    }
+
+    // Advances the epoch if every pinned thread has seen it and frees memory retired two epochs ago.
+    void collect() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        uint64_t epoch = global.load(std::memory_order_relaxed);
+        bool quiet = true;
+        for (record& rec : records) {
+            uint64_t pinned = rec.epoch.load(std::memory_order_acquire);
+            if (pinned != 0 && pinned != epoch) {
+                quiet = false;
+                break;
+            }
+        }
+        if (quiet)
+            global.store(++epoch, std::memory_order_release);
+
+        auto kept = std::remove_if(limbo.begin(), limbo.end(), [epoch](retired& item) {
+            if (item.epoch + 2 > epoch)
+                return false;
+            item.free(item.ptr);
+            return true;
+        });
+        limbo.erase(kept, limbo.end());
+    }
+};
+
+/*
+    Used via concurrent_index_table<T, S> to store items at their position in the table.
+
+    An index is claimed in two steps: its bit in <claimed> is set to reserve the index, the item
+    is written, then its bit in <ready> is set to publish it to readers and its sequence number
+    is made odd. Removal makes the sequence number even again with a compare-and-swap, so exactly
+    one remover wins an item and a remover that compared the item first (removet) only wins if
+    the index still holds that item. The winner then clears <ready> and <claimed> to free the index.
+
+    T: Type of data you want to store, must be trivially copyable.
+    S: Size of each bucket's cache for storing items.
+*/
+template<typename T, size_t S>
+class concurrent_index_bucket {
+    public:
+    // Number of 64-bit words in the occupancy bitmaps.
+    static constexpr size_t words = (S + 63) / 64;
+    // Mask of the valid bits in the last occupancy word.
+    static constexpr uint64_t tail = (S % 64) ? ((uint64_t(1) << (S % 64)) - 1) : ~uint64_t(0);
+    // Value of filled once the bucket has been closed for deallocation.
+    static constexpr int32_t closed = -1;
+
+    // Set for each index that is reserved by an inserter or holds an item.
+    std::atomic<uint64_t> claimed[words];
+    // Set for each index whose item is published to readers.
+    std::atomic<uint64_t> ready[words];
+    // Number of reserved indices, or closed once the bucket is being deallocated.
+    std::atomic<int32_t> filled;
+    int32_t bucket_index;
+    // Per index, odd while it holds an item and advanced on every publish and removal.
+    std::atomic<uint32_t> sequence[S];
+    std::atomic<T> items[S];
+
+    // Creates a new bucket with no indices in use.
+    concurrent_index_bucket(int32_t bucket_index) : filled(0), bucket_index(bucket_index) {
+        for (size_t w = 0; w < words; w++) {
+            claimed[w].store(0, std::memory_order_relaxed);
+            ready[w].store(0, std::memory_order_relaxed);
+        }
+        for (size_t i = 0; i < S; i++) {
+            sequence[i].store(0, std::memory_order_relaxed);
+            items[i].store(T(), std::memory_order_relaxed);
+        }
+    }
+
+    // Reserves up to <want> indices in the bucket and returns how many, 0 if the bucket is full or closed.
+    int32_t reserve(int32_t want) {
+        int32_t count = filled.load(std::memory_order_relaxed);
+        while (count >= 0 && count < static_cast<int32_t>(S)) {
+            int32_t got = std::min(want, static_cast<int32_t>(S) - count);
+            if (filled.compare_exchange_weak(count, count + got, std::memory_order_acquire, std::memory_order_relaxed))
+                return got;
+        }
+        return 0;
+    }
+
+    // Claims <count> free indices after reserving them and writes them to <slots>.
+    void claim(int32_t count, int32_t* slots) {
+        while (count > 0) {
+            for (size_t w = 0; w < words && count > 0; w++) {
+                uint64_t bits = claimed[w].load(std::memory_order_relaxed);
+                for (;;) {
+                    // Take the lowest free bits of the word, as many as are still needed.
+                    uint64_t free = ~bits & ((w == words - 1) ? tail : ~uint64_t(0));
+                    uint64_t take = 0;
+                    for (int32_t n = 0; n < count && free != 0; n++) {
+                        take |= free & (~free + 1);
+                        free &= free - 1;
+                    }
+                    if (take == 0)
+                        break;
+                    if (claimed[w].compare_exchange_weak(bits, bits | take, std::memory_order_acquire, std::memory_order_relaxed)) {
+                        for (; take != 0; take &= take - 1)
+                            slots[--count] = static_cast<int32_t>(w * 64) + index_ctz(take);
+                        break;
+                    }
+                }
+            }
+        }
+    }
+
+    // Writes the item to a claimed index and publishes it to readers, then to removers.
+    void publish(int32_t index, T item) {
+        items[index].store(item, std::memory_order_relaxed);
+        ready[index / 64].fetch_or(uint64_t(1) << (index % 64), std::memory_order_release);
+        // Only the owner of a claimed index changes an even sequence number.
+        sequence[index].store(sequence[index].load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    // Returns whether the index in the bucket holds a published item.
+    bool occupied(int32_t index) const {
+        return (ready[index / 64].load(std::memory_order_acquire) >> (index % 64)) & 1;
+    }
+
+    // Unpublishes the item at the index and stores it in <item>, returns false if another remover won it.
+    bool take(int32_t index, T& item) {
+        return take_if(index, item, [](const T&) { return true; });
+    }
+
+    // Unpublishes the item at the index into <item> only if match(item), returns false if it did not match or another remover won it.
+    // The item is compared and taken under one sequence number, so a mismatch leaves the index untouched for its owner.
+    template<typename F>
+    bool take_if(int32_t index, T& item, F&& match) {
+        uint32_t seq = sequence[index].load(std::memory_order_acquire);
+        do {
+            if ((seq & 1) == 0)
+                return false;
+            item = items[index].load(std::memory_order_relaxed);
+            if (!match(item))
+                return false;
+        } while (!sequence[index].compare_exchange_weak(seq, seq + 1, std::memory_order_acq_rel, std::memory_order_acquire));
+        ready[index / 64].fetch_and(~(uint64_t(1) << (index % 64)), std::memory_order_release);
+        return true;
+    }
+
+    // Frees an index after take(), returns the number of indices still reserved (0 once the bucket is empty).
+    int32_t vacate(int32_t index) {
+        claimed[index / 64].fetch_and(~(uint64_t(1) << (index % 64)), std::memory_order_release);
+        return filled.fetch_sub(1, std::memory_order_acq_rel) - 1;
+    }
+
+    // Closes an empty bucket for deallocation, returns false if an inserter reserved an index first.
+    bool close() {
+        int32_t count = 0;
+        return filled.compare_exchange_strong(count, closed, std::memory_order_acq_rel);
+    }
+};
+
+/*
+    Lock-free form of index_table that can be shared between threads.
+
+    T: Type of data you want to store, must be trivially copyable.
+    S: Size of each bucket's cache for storing items.
+*/
+template<typename T, size_t S>
+class concurrent_index_table {
+    static_assert(std::is_trivially_copyable<T>::value, "concurrent_index_table requires a trivially copyable T");
+
+    // Number of indices reserved per magazine refill.
+    static constexpr int32_t batch = static_cast<int32_t>(std::min<size_t>(INDEX_TABLE_MAGAZINE, S));
+    // Highest bucket index whose indices all fit in int32_t.
+    static constexpr int32_t max_bucket = static_cast<int32_t>((static_cast<size_t>(INT32_MAX) - (S - 1)) / S);
+
+    // Indices of one bucket reserved by a thread. The reservation keeps the bucket alive, so no pin is needed to use it.
+    struct alignas(64) magazine {
+        concurrent_index_bucket<T, S>* bckt = nullptr;
+        int32_t count = 0;
+        int32_t slots[batch];
+    };
+
+    // Fixed-size array of bucket pointers indexed by bucket index, replaced as a whole when it grows.
+    struct directory {
+        size_t size;
+        std::unique_ptr<std::atomic<concurrent_index_bucket<T, S>*>[]> slots;
+        // One bit per bucket index, set while the bucket may have a free index. Inserters clear it once they find the bucket full.
+        std::unique_ptr<std::atomic<uint64_t>[]> open;
+
+        directory(size_t size) : size(size), slots(new std::atomic<concurrent_index_bucket<T, S>*>[size]()), open(new std::atomic<uint64_t>[words(size)]()) {}
+
+        // Returns the number of words in the open bitmap of a directory with <size> slots.
+        static size_t words(size_t size) { return (size + 63) / 64; }
+    };
+
+    // Current bucket directory, published with release so readers see fully copied entries.
+    std::atomic<directory*> buckets;
+    // Bucket that the last insert went into, tried first by the next insert.
+    std::atomic<concurrent_index_bucket<T, S>*> current{ nullptr };
+    // Guards bucket creation and deallocation, and every write to the directory.
+    std::mutex lock;
+    // Keeps track of all bucket indices of deleted buckets so that the indices can be re-queued for new buckets.
+    std::vector<int32_t> empty;
+    // Tracks the next bucket index for creating buckets when all buckets from 0 to N are full.
+    int32_t bucket_hiindex = 0;
+    // Lowest word of the open bitmap that may have a set bit, so inserters skip the prefix of full buckets.
+    std::atomic<size_t> vacancy{ 0 };
+    // Reclaims deallocated buckets and directories.
+    index_epoch epoch;
+    // Per-thread magazines, indexed by index_thread_id().
+    std::unique_ptr<magazine[]> magazines{ new magazine[INDEX_TABLE_MAX_THREADS] };
+
+    // Gets the item at the specified index, else T(). The caller must be pinned.
+    T peek(int32_t index) {
+        concurrent_index_bucket<T, S>* bckt = locate(index);
+        if (bckt == nullptr || !bckt->occupied(index_math<S>::slot(index)))
+            return T();
+        return bckt->items[index_math<S>::slot(index)].load(std::memory_order_relaxed);
+    }
+
+    // Returns the bucket that holds the range of the specified index, else nullptr. The caller must be pinned.
+    concurrent_index_bucket<T, S>* locate(int32_t index) {
+        if (index < 0)
+            return nullptr;
+        size_t bindex = static_cast<size_t>(index_math<S>::bucket(index));
+        directory* dir = buckets.load(std::memory_order_acquire);
+        return (bindex < dir->size) ? dir->slots[bindex].load(std::memory_order_acquire) : nullptr;
+    }
+
+    // Lowers the vacancy hint to word <w> of the open bitmap.
+    void lower(size_t w) {
+        size_t low = vacancy.load(std::memory_order_seq_cst);
+        while (low > w && !vacancy.compare_exchange_weak(low, w, std::memory_order_seq_cst))
+            ;
+    }
+
+    /*
+        Sets the open bit of a bucket index that has a free index. The bit is set again in every
+        directory published meanwhile, and the grower ORs the old bits into the new directory after
+        publishing it, so one of the two always carries the bit over. The caller must be pinned.
+    */
+    void reopen(int32_t bindex) {
+        size_t w = static_cast<size_t>(bindex) / 64;
+        directory* dir = buckets.load(std::memory_order_seq_cst);
+        for (;;) {
+            dir->open[w].fetch_or(uint64_t(1) << (bindex % 64), std::memory_order_seq_cst);
+            lower(w);
+            directory* now = buckets.load(std::memory_order_seq_cst);
+            if (now == dir)
+                return;
+            dir = now;
+        }
+    }
+
+    // Clears the open bit of a bucket index found without a free index, then reopens it if an index was freed meanwhile. The caller must be pinned.
+    void shut(directory* dir, size_t bindex) {
+        dir->open[bindex / 64].fetch_and(~(uint64_t(1) << (bindex % 64)), std::memory_order_acq_rel);
+        concurrent_index_bucket<T, S>* bckt = dir->slots[bindex].load(std::memory_order_acquire);
+        if (bckt == nullptr)
+            return;
+        int32_t count = bckt->filled.load(std::memory_order_acquire);
+        if (count >= 0 && count < static_cast<int32_t>(S))
+            reopen(static_cast<int32_t>(bindex));
+    }
+
+    // Reserves up to a batch of indices in any existing bucket with a free index into <got>, else returns nullptr. The caller must be pinned.
+    concurrent_index_bucket<T, S>* find(int32_t& got) {
+        concurrent_index_bucket<T, S>* bckt = current.load(std::memory_order_acquire);
+        if (bckt != nullptr && (got = bckt->reserve(batch)) > 0)
+            return bckt;
+
+        // Only buckets whose open bit is set are tried, starting at the vacancy hint.
+        directory* dir = buckets.load(std::memory_order_seq_cst);
+        for (size_t w = vacancy.load(std::memory_order_seq_cst); w < directory::words(dir->size); w++) {
+            for (uint64_t bits = dir->open[w].load(std::memory_order_acquire); bits != 0; bits &= bits - 1) {
+                size_t bindex = w * 64 + index_ctz(bits);
+                bckt = dir->slots[bindex].load(std::memory_order_acquire);
+                if (bckt != nullptr && (got = bckt->reserve(batch)) > 0) {
+                    current.store(bckt, std::memory_order_release);
+                    return bckt;
+                }
+                shut(dir, bindex);
+            }
+
+            // Move the hint past a word without open buckets, and back if a bucket in it was reopened meanwhile.
+            size_t expected = w;
+            if (dir->open[w].load(std::memory_order_seq_cst) == 0 && vacancy.compare_exchange_strong(expected, w + 1, std::memory_order_seq_cst)) {
+                if (buckets.load(std::memory_order_seq_cst)->open[w].load(std::memory_order_seq_cst) != 0)
+                    lower(w);
+            }
+        }
+        return nullptr;
+    }
+
+    // Creates a new bucket with a batch of indices already reserved for the caller into <got>, unless another thread made room first.
+    // Returns nullptr if every bucket index up to max_bucket is in use. The caller must be pinned.
+    concurrent_index_bucket<T, S>* bucket(int32_t& got) {
+        std::lock_guard<std::mutex> hold(lock);
+
+        // Another inserter may have created a bucket while this one waited for the lock.
+        concurrent_index_bucket<T, S>* bckt = current.load(std::memory_order_acquire);
+        if (bckt != nullptr && (got = bckt->reserve(batch)) > 0)
+            return bckt;
+
+        int32_t bindex;
+        if (!empty.empty()) {
+            bindex = empty.back();
+            empty.pop_back();
+        } else if (bucket_hiindex > max_bucket) {
+            got = 0;
+            return nullptr;
+        } else {
+            bindex = bucket_hiindex++;
+        }
+
+        directory* dir = buckets.load(std::memory_order_relaxed);
+        if (static_cast<size_t>(bindex) >= dir->size) {
+            size_t size = std::min(std::max(dir->size * 2, static_cast<size_t>(bindex) + 1), static_cast<size_t>(max_bucket) + 1);
+            directory* grown = new directory(size);
+            for (size_t i = 0; i < dir->size; i++)
+                grown->slots[i].store(dir->slots[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+            for (size_t w = 0; w < directory::words(dir->size); w++)
+                grown->open[w].store(dir->open[w].load(std::memory_order_relaxed), std::memory_order_relaxed);
+            buckets.store(grown, std::memory_order_seq_cst);
+            // Carry over open bits set in the old directory while it was copied, see reopen().
+            for (size_t w = 0; w < directory::words(dir->size); w++)
+                grown->open[w].fetch_or(dir->open[w].load(std::memory_order_seq_cst), std::memory_order_seq_cst);
+            epoch.retire(dir);
+            dir = grown;
+        }
+
+        bckt = new concurrent_index_bucket<T, S>(bindex);
+        got = bckt->reserve(batch);
+        dir->slots[bindex].store(bckt, std::memory_order_release);
+        if (got < static_cast<int32_t>(S))
+            reopen(bindex);
+        current.store(bckt, std::memory_order_release);
+        return bckt;
+    }
+
+    // Deallocates a bucket that became empty, unless an inserter reserved an index in it first.
+    void release(concurrent_index_bucket<T, S>* bckt) {
+        if (!bckt->close())
+            return;
+
+        std::lock_guard<std::mutex> hold(lock);
+        buckets.load(std::memory_order_relaxed)->slots[bckt->bucket_index].store(nullptr, std::memory_order_release);
+        concurrent_index_bucket<T, S>* expected = bckt;
+        current.compare_exchange_strong(expected, nullptr);
+        empty.push_back(bckt->bucket_index);
+        epoch.retire(bckt);
+    }
+
+    // Refills the calling thread's empty magazine with a batch of reserved indices, returns false if every index is in use. The caller must be pinned.
+    bool refill(magazine& mag) {
+        int32_t got = 0;
+        concurrent_index_bucket<T, S>* bckt = find(got);
+        if (bckt == nullptr)
+            bckt = bucket(got);
+        if (bckt == nullptr)
+            return false;
+        bckt->claim(got, mag.slots);
+        mag.bckt = bckt;
+        mag.count = got;
+        return true;
+    }
+
+    // Returns a reserved index to its bucket, reopening the bucket if it was full and deallocating it once empty. The caller must be pinned.
+    void unreserve(concurrent_index_bucket<T, S>* bckt, int32_t slot) {
+        int32_t left = bckt->vacate(slot);
+        if (left == 0)
+            release(bckt);
+        else if (left == static_cast<int32_t>(S) - 1)
+            reopen(bckt->bucket_index);
+    }
+
+    // Frees an index whose item was taken, keeping it in the calling thread's magazine if it has room.
+    void vacate(concurrent_index_bucket<T, S>* bckt, int32_t slot) {
+        magazine& mag = magazines[index_thread_id()];
+        if (mag.count == 0)
+            mag.bckt = bckt;
+        if (mag.bckt == bckt && mag.count < batch) {
+            mag.slots[mag.count++] = slot;
+            return;
+        }
+        unreserve(bckt, slot);
+    }
+
+    // Removes the item at the index of the bucket into <item>, returns false if the index held no item. The caller must be pinned.
+    bool take(concurrent_index_bucket<T, S>* bckt, int32_t slot, T& item) {
+        if (!bckt->take(slot, item))
+            return false;
+        vacate(bckt, slot);
+        return true;
+    }
+
+    public:
+    // Create a table with a number of pre-existing buckets as "cache."
+    concurrent_index_table(int32_t cache) {
+        cache = static_cast<int32_t>(std::min<int64_t>(cache, int64_t(max_bucket) + 1));
+        directory* dir = new directory(std::max<int32_t>(cache, 1));
+        for (int32_t i = 0; i < cache; i++) {
+            dir->slots[i].store(new concurrent_index_bucket<T, S>(bucket_hiindex++), std::memory_order_relaxed);
+            dir->open[i / 64].fetch_or(uint64_t(1) << (i % 64), std::memory_order_relaxed);
+        }
+        buckets.store(dir, std::memory_order_release);
+    }
+
+    concurrent_index_table(const concurrent_index_table&) = delete;
+    concurrent_index_table& operator=(const concurrent_index_table&) = delete;
+
+    // Destroys all buckets, no other thread may be using the table.
+    ~concurrent_index_table() {
+        directory* dir = buckets.load(std::memory_order_relaxed);
+        for (size_t i = 0; i < dir->size; i++)
+            delete dir->slots[i].load(std::memory_order_relaxed);
+        delete dir;
+    }
+
+    // Returns the number of allocated items in all buckets, a snapshot while other threads modify the table.
+    size_t count() {
+        index_epoch::guard pin(epoch);
+        directory* dir = buckets.load(std::memory_order_acquire);
+        size_t total = 0;
+        for (size_t i = 0; i < dir->size; i++) {
+            concurrent_index_bucket<T, S>* bckt = dir->slots[i].load(std::memory_order_acquire);
+            if (bckt != nullptr) {
+                for (size_t w = 0; w < bckt->words; w++)
+                    total += index_popcount(bckt->ready[w].load(std::memory_order_relaxed));
+            }
+        }
+        return total;
+    }
+
+    // Returns the static bucket size.
+    size_t sizeb() { return S; }
+
+    // Returns the size the items <T>.
+    size_t sizei() { return sizeof(T); }
+
+    // Returns the indices left in the calling thread's magazine to their bucket, so an otherwise empty bucket can be deallocated.
+    void flush() {
+        index_epoch::guard pin(epoch);
+        magazine& mag = magazines[index_thread_id()];
+        while (mag.count > 0)
+            unreserve(mag.bckt, mag.slots[--mag.count]);
+        mag.bckt = nullptr;
+    }
+
+    // Inserts a new item into the index table, taking the index from the calling thread's magazine. Returns -1 if every index is in use.
+    int32_t insert(T item) {
+        magazine& mag = magazines[index_thread_id()];
+        if (mag.count == 0) {
+            index_epoch::guard pin(epoch);
+            if (!refill(mag))
+                return -1;
+        }
+
+        concurrent_index_bucket<T, S>* bckt = mag.bckt;
+        int32_t slot = mag.slots[--mag.count];
+        bckt->publish(slot, item);
+        return index_math<S>::index(bckt->bucket_index, slot);
+    }
+
+    // Removes the item at the specified index from the index table.
+    T removei(int32_t index) {
+        index_epoch::guard pin(epoch);
+        concurrent_index_bucket<T, S>* bckt = locate(index);
+        T item = T();
+        if (bckt != nullptr && !take(bckt, index_math<S>::slot(index), item))
+            return T();
+        return item;
+    }
+
+    // Removes the specified item from the index table.
+    int32_t removet(T item) {
+        index_epoch::guard pin(epoch);
+        for (;;) {
+            int32_t index = gett(item);
+            if (index < 0)
+                return -1;
+
+            // The index may have been removed or re-used since gett, so only take it while it still holds the item.
+            concurrent_index_bucket<T, S>* bckt = locate(index);
+            T found;
+            if (bckt == nullptr || !bckt->take_if(index_math<S>::slot(index), found, [&item](const T& held) { return held == item; }))
+                continue;
+            vacate(bckt, index_math<S>::slot(index));
+            return index;
+        }
+    }
+
+    // Gets the index of the specified item.
+    int32_t gett(T item) {
+        index_epoch::guard pin(epoch);
+        directory* dir = buckets.load(std::memory_order_acquire);
+        for (size_t i = 0; i < dir->size; i++) {
+            concurrent_index_bucket<T, S>* bckt = dir->slots[i].load(std::memory_order_acquire);
+            if (bckt == nullptr)
+                continue;
+            for (size_t w = 0; w < bckt->words; w++) {
+                for (uint64_t bits = bckt->ready[w].load(std::memory_order_acquire); bits != 0; bits &= bits - 1) {
+                    int32_t slot = static_cast<int32_t>(w * 64) + index_ctz(bits);
+                    if (bckt->items[slot].load(std::memory_order_relaxed) == item)
+                        return index_math<S>::index(bckt->bucket_index, slot);
+                }
+            }
+        }
+        return -1;
+    }
+
+    // Gets the item at the specified index.
+    T geti(int32_t index) {
+        index_epoch::guard pin(epoch);
+        return peek(index);
+    }
+
+    /*
+        Read-side critical section over the table. The calling thread is pinned once for the
+        lifetime of the view, so any number of geti calls and iterations inside it use only
+        acquire loads, with no fence or read-modify-write per call. Writers keep running: a view
+        sees each item as published when it is read, and buckets or directories replaced while
+        the view is alive are not freed until it is destroyed. A view belongs to the thread that
+        created it and should be short-lived, since it holds back reclamation.
+    */
+    class read_view {
+        concurrent_index_table* table;
+        index_epoch::guard pin;
+
+        public:
+        read_view(concurrent_index_table& table) : table(&table), pin(table.epoch) {}
+
+        // Gets the item at the specified index, else T().
+        T geti(int32_t index) const { return table->peek(index); }
+
+        // Calls f(index, item) for every published item in bucket index order.
+        template<typename F>
+        void for_each(F&& f) const {
+            directory* dir = table->buckets.load(std::memory_order_acquire);
+            for (size_t i = 0; i < dir->size; i++) {
+                concurrent_index_bucket<T, S>* bckt = dir->slots[i].load(std::memory_order_acquire);
+                if (bckt == nullptr)
+                    continue;
+                for (size_t w = 0; w < bckt->words; w++) {
+                    for (uint64_t bits = bckt->ready[w].load(std::memory_order_acquire); bits != 0; bits &= bits - 1) {
+                        int32_t slot = static_cast<int32_t>(w * 64) + index_ctz(bits);
+                        f(index_math<S>::index(bckt->bucket_index, slot), bckt->items[slot].load(std::memory_order_relaxed));
+                    }
+                }
+            }
+        }
+    };
+
+    // Opens a read view on the calling thread, see read_view.
+    read_view view() { return read_view(*this); }
+};
+
+#endif
@@ -12,11 +12,761 @@
     be deallocated, but returned through the removal functions.
 */
 #include <vector>
-#include <stack>
 #include <algorithm>
-#include <numeric>
 #include <iterator>
 #include <functional>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <optional>
+#include <type_traits>
+#include <limits>
+#include <unordered_map>
+#include <map>
+#include <istream>
+#include <ostream>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// Returns the position of the lowest set bit in a non-zero 64-bit word.
+inline int32_t index_ctz(uint64_t bits) {
+#if defined(_MSC_VER)
+    unsigned long pos;
+    _BitScanForward64(&pos, bits);
+    return static_cast<int32_t>(pos);
+#else
+    return __builtin_ctzll(bits);
+#endif
+}
+
+// Hints the CPU to start loading the cache line holding the address.
+inline void index_prefetch(const void* address) {
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    _mm_prefetch(static_cast<const char*>(address), _MM_HINT_T0);
+#elif defined(_MSC_VER)
+    (void)address;
+#else
+    __builtin_prefetch(address);
+#endif
+}
+
+// Returns the number of set bits in a 64-bit word.
+inline int32_t index_popcount(uint64_t bits) {
+#if defined(_MSC_VER)
+    return static_cast<int32_t>(__popcnt64(bits));
+#else
+    return __builtin_popcountll(bits);
+#endif
+}
+
+/*
+    SIMD compare kernels used by index_bucket to search 64 items at a time.
+
+    Each kernel compares 64 consecutive 4 or 8 byte values against a key and returns a bitmask
+    with bit i set where run[i] == key. The widest instruction set the CPU supports is picked
+    once at runtime (AVX-512, AVX2, else scalar) on x86 with GCC/Clang, NEON is always used on
+    AArch64. Define INDEX_TABLE_NO_SIMD to always use the scalar loops.
+*/
+#if !defined(INDEX_TABLE_NO_SIMD) && (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define INDEX_TABLE_SIMD_X86
+#include <immintrin.h>
+#elif !defined(INDEX_TABLE_NO_SIMD) && defined(__aarch64__)
+#define INDEX_TABLE_SIMD_NEON
+#include <arm_neon.h>
+#endif
+
+// Whether values of type K can be compared by their bits with the SIMD kernels.
+template<typename K>
+struct index_simd_comparable : std::integral_constant<bool,
+    (std::is_integral<K>::value || std::is_enum<K>::value || std::is_pointer<K>::value) && (sizeof(K) == 4 || sizeof(K) == 8)> {};
+
+// Compares 64 values of type K against key with a plain loop.
+template<typename K>
+inline uint64_t index_match_scalar(const void* run, uint64_t key) {
+    const K* values = static_cast<const K*>(run);
+    K match = static_cast<K>(key);
+    uint64_t bits = 0;
+    for (size_t i = 0; i < 64; i++)
+        bits |= uint64_t(values[i] == match) << i;
+    return bits;
+}
+
+#if defined(INDEX_TABLE_SIMD_X86)
+__attribute__((target("avx2"))) inline uint64_t index_match_avx2_32(const void* run, uint64_t key) {
+    const __m256i* values = static_cast<const __m256i*>(run);
+    __m256i match = _mm256_set1_epi32(static_cast<int32_t>(key));
+    uint64_t bits = 0;
+    for (int i = 0; i < 8; i++) {
+        __m256i eq = _mm256_cmpeq_epi32(_mm256_loadu_si256(values + i), match);
+        bits |= uint64_t(static_cast<uint32_t>(_mm256_movemask_ps(_mm256_castsi256_ps(eq)))) << (i * 8);
+    }
+    return bits;
+}
+
+__attribute__((target("avx2"))) inline uint64_t index_match_avx2_64(const void* run, uint64_t key) {
+    const __m256i* values = static_cast<const __m256i*>(run);
+    __m256i match = _mm256_set1_epi64x(static_cast<int64_t>(key));
+    uint64_t bits = 0;
+    for (int i = 0; i < 16; i++) {
+        __m256i eq = _mm256_cmpeq_epi64(_mm256_loadu_si256(values + i), match);
+        bits |= uint64_t(static_cast<uint32_t>(_mm256_movemask_pd(_mm256_castsi256_pd(eq)))) << (i * 4);
+    }
+    return bits;
+}
+
+__attribute__((target("avx512f"))) inline uint64_t index_match_avx512_32(const void* run, uint64_t key) {
+    const char* values = static_cast<const char*>(run);
+    __m512i match = _mm512_set1_epi32(static_cast<int32_t>(key));
+    uint64_t bits = 0;
+    for (int i = 0; i < 4; i++)
+        bits |= uint64_t(_mm512_cmpeq_epi32_mask(_mm512_loadu_si512(values + i * 64), match)) << (i * 16);
+    return bits;
+}
+
+__attribute__((target("avx512f"))) inline uint64_t index_match_avx512_64(const void* run, uint64_t key) {
+    const char* values = static_cast<const char*>(run);
+    __m512i match = _mm512_set1_epi64(static_cast<int64_t>(key));
+    uint64_t bits = 0;
+    for (int i = 0; i < 8; i++)
+        bits |= uint64_t(_mm512_cmpeq_epi64_mask(_mm512_loadu_si512(values + i * 64), match)) << (i * 8);
+    return bits;
+}
+#elif defined(INDEX_TABLE_SIMD_NEON)
+inline uint64_t index_match_neon_32(const void* run, uint64_t key) {
+    const uint32_t* values = static_cast<const uint32_t*>(run);
+    uint32x4_t match = vdupq_n_u32(static_cast<uint32_t>(key));
+    const uint32_t lanes[4] = { 1, 2, 4, 8 };
+    uint32x4_t weight = vld1q_u32(lanes);
+    uint64_t bits = 0;
+    for (int i = 0; i < 16; i++)
+        bits |= uint64_t(vaddvq_u32(vandq_u32(vceqq_u32(vld1q_u32(values + i * 4), match), weight))) << (i * 4);
+    return bits;
+}
+
+inline uint64_t index_match_neon_64(const void* run, uint64_t key) {
+    const uint64_t* values = static_cast<const uint64_t*>(run);
+    uint64x2_t match = vdupq_n_u64(key);
+    const uint64_t lanes[2] = { 1, 2 };
+    uint64x2_t weight = vld1q_u64(lanes);
+    uint64_t bits = 0;
+    for (int i = 0; i < 32; i++)
+        bits |= vaddvq_u64(vandq_u64(vceqq_u64(vld1q_u64(values + i * 2), match), weight)) << (i * 2);
+    return bits;
+}
+#endif
+
+// Kernels selected for the running CPU.
+struct index_simd {
+    uint64_t (*match32)(const void*, uint64_t);
+    uint64_t (*match64)(const void*, uint64_t);
+};
+
+// Returns the kernels for the widest instruction set the CPU supports, chosen on first use.
+inline const index_simd& index_simd_kernels() {
+    static const index_simd kernels = []() {
+#if defined(INDEX_TABLE_SIMD_X86)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f"))
+            return index_simd{ index_match_avx512_32, index_match_avx512_64 };
+        if (__builtin_cpu_supports("avx2"))
+            return index_simd{ index_match_avx2_32, index_match_avx2_64 };
+#elif defined(INDEX_TABLE_SIMD_NEON)
+        return index_simd{ index_match_neon_32, index_match_neon_64 };
+#endif
+        return index_simd{ index_match_scalar<uint32_t>, index_match_scalar<uint64_t> };
+    }();
+    return kernels;
+}
+
+// Returns a bitmask of the 64 values in run equal to key, using the SIMD kernels.
+template<typename K>
+inline uint64_t index_match(const K* run, const K& key) {
+    static_assert(index_simd_comparable<K>::value, "index_match requires a 4 or 8 byte integral, enum or pointer type");
+    uint64_t bits = 0;
+    std::memcpy(&bits, &key, sizeof(K));
+    return (sizeof(K) == 4) ? index_simd_kernels().match32(run, bits) : index_simd_kernels().match64(run, bits);
+}
+
+/*
+    Compile-time options for index_table<T, S, Options>, combined with |.
+
+    recent_first: Insert into the bucket that most recently had an index freed instead of
+                  the bucket with the lowest bucket index (keeps the key space compact).
+    reverse_lookup: Keep a hash index from items to their indices so gett/removet are O(1)
+                  expected instead of scanning every bucket. Requires the traits' hash, by
+                  default std::hash<T>.
+    generations:  Keep a generation counter per index that is bumped on every removal, so
+                  handles from inserth/geth can detect that their index was re-used.
+    split_keys:   Keep each item's key (see index_traits) in a separate contiguous array per
+                  bucket, so gett/getk scan only the keys instead of whole items.
+    statistics:   Count hot-path events (free bucket searches, bucket churn) for stats().
+                  Without it the counters are compiled out.
+    deferred:     Removals only clear the slot. Buckets they empty are queued and only
+                  retained or deallocated by the next maintain() call.
+*/
+struct index_options {
+    enum : unsigned {
+        recent_first = 1u << 0,
+        reverse_lookup = 1u << 1,
+        generations = 1u << 2,
+        split_keys = 1u << 3,
+        statistics = 1u << 4,
+        deferred = 1u << 5
+    };
+};
+
+/*
+    Key projection used by index_options::split_keys. Specialize it to search items of a larger
+    type by a single field, for example:
+
+        template<> struct index_key<entity> {
+            using type = uint64_t;
+            static uint64_t get(const entity& item) { return item.id; }
+        };
+
+    The key of a stored item must not be changed through find() or an iterator.
+*/
+template<typename T>
+struct index_key {
+    using type = T;
+    static const T& get(const T& item) { return item; }
+};
+
+/*
+    Compile-time policies for how index_table<T, S, Options, Index, Alloc, Traits> keys, hashes
+    and compares items, resolved statically so they cost no indirection. Derive from it to
+    change only some of them, for example to compare floats by bit pattern or pointers by the
+    object they point to:
+
+        struct by_name : index_traits<person*> {
+            struct hash { size_t operator()(person* p) const { return std::hash<std::string>()(p->name); } };
+            struct equal { bool operator()(person* a, person* b) const { return a->name == b->name; } };
+        };
+
+    key:       Projection of an item to the key split_keys stores and getk searches (an index_key).
+    key_equal: Equality of keys.
+    hash:      Hash of items for the reverse_lookup option.
+    equal:     Equality of items for gett, removet and the reverse_lookup option.
+
+    Whole words of items or keys are only compared with the SIMD kernels while equal, respectively
+    key_equal, is std::equal_to, since those compare bit patterns.
+*/
+template<typename T>
+struct index_traits {
+    using key = index_key<T>;
+    using key_equal = std::equal_to<typename index_key<T>::type>;
+    using hash = std::hash<T>;
+    using equal = std::equal_to<T>;
+};
+
+// Returns floor(log2(value)) for a non-zero value.
+constexpr int32_t index_log2(size_t value) { return (value > 1) ? 1 + index_log2(value / 2) : 0; }
+
+/*
+    Index arithmetic for buckets of size <S> on indices of any integer type <I>. When S is a
+    power of two the bucket index and slot are a shift and a mask instead of a division and a
+    remainder. Indices are computed in <I>, so there is no int32_t overflow for wider types.
+*/
+template<size_t S>
+struct index_math {
+    static_assert(S > 0, "index_table requires a bucket size S greater than 0");
+    static constexpr bool pow2 = (S & (S - 1)) == 0;
+    static constexpr int32_t shift = index_log2(S);
+
+    // Returns the bucket index holding a non-negative index.
+    template<typename I>
+    static constexpr I bucket(I index) {
+        if constexpr (pow2)
+            return index >> shift;
+        else
+            return index / static_cast<I>(S);
+    }
+
+    // Returns the slot of a non-negative index within its bucket.
+    template<typename I>
+    static constexpr int32_t slot(I index) {
+        if constexpr (pow2)
+            return static_cast<int32_t>(index & static_cast<I>(S - 1));
+        else
+            return static_cast<int32_t>(index % static_cast<I>(S));
+    }
+
+    // Returns the index of a slot in a bucket.
+    template<typename I>
+    static constexpr I index(I bucket, int32_t slot) {
+        if constexpr (pow2)
+            return (bucket << shift) | static_cast<I>(slot);
+        else
+            return bucket * static_cast<I>(S) + static_cast<I>(slot);
+    }
+};
+
+// Smallest unsigned type that can count 0 to S items, so small buckets pack tighter.
+template<size_t S>
+using index_count = typename std::conditional<(S < 256), uint8_t, typename std::conditional<(S < 65536), uint16_t, uint32_t>::type>::type;
+
+// Stand-in member type for table state that is compiled out by its option.
+struct index_none {};
+
+// Hot-path event counters of an index_table, counted since it was created (statistics option).
+struct index_counters {
+    // Searches for a bucket with a free index, and the free-list bitmap words they scanned.
+    size_t searches = 0;
+    size_t scanned = 0;
+    // Buckets constructed and deallocated.
+    size_t created = 0;
+    size_t released = 0;
+    // Buckets that became empty and were kept alive by retain(), and retained buckets that were filled again.
+    size_t retained = 0;
+    size_t revived = 0;
+    // Slabs of bucket storage allocated.
+    size_t slabs = 0;
+    // Items moved by compact().
+    size_t moved = 0;
+};
+
+/*
+    Binary snapshot written by index_table::save and read by index_table::load / index_table_view.
+    All fields are in native byte order. The layout is:
+
+        index_snapshot_header
+        uint64_t table[header.pages]                    bucket index / page of each directory page, ascending
+        uint64_t pages[header.pages][page]              record number of each bucket index in the page, else UINT64_MAX
+        record[header.records]                          one per live bucket, in bucket index order
+        uint64_t lineage[header.lineage][2]             (bucket index, generation it restarts at), ascending (generations only)
+        uint64_t order[open + idle + pending + queued]  bucket indices: the free list from its head (recent_first only),
+                                                        retained empty buckets, the maintain() queue and the queued buckets (deferred only)
+
+    where a record is the bucket index (uint64_t), the occupancy bitmap and the raw items array,
+    followed by the per-index generations when the table uses index_options::generations. Only
+    pages holding a bucket and ranges that had a bucket deallocated are written, so the size of a
+    snapshot follows its buckets, not the range of its indices. The directory and the records are
+    padded so items stay aligned when the snapshot is mapped. The order section holds the state
+    that decides which bucket the next insert or maintain() uses, so a restored table hands out
+    the same indices as the saved one.
+*/
+struct index_snapshot_header {
+    char magic[8];
+    uint32_t version;
+    // index_options::generations when the records hold generations.
+    uint32_t flags;
+    uint64_t item_size;
+    uint64_t item_align;
+    uint64_t bucket_size;
+    uint64_t index_size;
+    uint64_t items;
+    uint64_t records;
+    uint64_t directory;
+    uint64_t pages;
+    uint64_t lineage;
+    // Number of bucket indices in each part of the order section.
+    uint64_t open;
+    uint64_t idle;
+    uint64_t pending;
+    uint64_t queued;
+
+    static constexpr char signature[8] = { 'I', 'D', 'X', 'T', 'A', 'B', 'L', 'E' };
+    static constexpr uint32_t current = 3;
+};
+
+// Adds count * size to total and returns true, else returns false when the sum would overflow.
+inline bool index_grow(uint64_t& total, uint64_t count, uint64_t size) {
+    if (size != 0 && count > (~uint64_t(0) - total) / size)
+        return false;
+    total += count * size;
+    return true;
+}
+
+// Discards <bytes> bytes of the stream, returning false when it ends first.
+inline bool index_skip(std::istream& in, uint64_t bytes) {
+    const uint64_t chunk = uint64_t(1) << 30;
+    for (; bytes > 0; bytes -= std::min(bytes, chunk)) {
+        std::streamsize step = static_cast<std::streamsize>(std::min(bytes, chunk));
+        if (!in.ignore(step) || in.gcount() != step)
+            return false;
+    }
+    return true;
+}
+
+// Reads <count> uint64_t values into <values> a chunk at a time, so a corrupt count cannot allocate more than the stream holds.
+inline bool index_read(std::istream& in, uint64_t count, std::vector<uint64_t>& values) {
+    values.clear();
+    while (values.size() < count) {
+        size_t at = values.size();
+        values.resize(static_cast<size_t>(std::min<uint64_t>(count, at + 4096)));
+        if (!in.read(reinterpret_cast<char*>(values.data() + at), static_cast<std::streamsize>(sizeof(uint64_t) * (values.size() - at))))
+            return false;
+    }
+    return true;
+}
+
+// Offsets of the sections of a snapshot of items <T> in buckets of size <S>.
+template<typename T, size_t S>
+struct index_snapshot_layout {
+    static constexpr size_t words = (S + 63) / 64;
+    static constexpr size_t align = (alignof(T) > 8) ? alignof(T) : 8;
+
+    static constexpr size_t page = 512;
+
+    static constexpr size_t round(size_t size, size_t to) { return (size + to - 1) / to * to; }
+
+    // Offset of the items array and of the generations in a record.
+    static constexpr size_t items = round(sizeof(uint64_t) * (1 + words), alignof(T));
+    static constexpr size_t generation = items + sizeof(T) * S;
+
+    // Size of each record.
+    static constexpr size_t record(bool generations) { return round(generation + (generations ? sizeof(uint32_t) * S : 0), align); }
+
+    // Offset of the directory pages and of the first record of a snapshot with the page count.
+    static constexpr size_t pages(size_t count) { return sizeof(index_snapshot_header) + sizeof(uint64_t) * count; }
+    static constexpr size_t records(size_t count) { return round(pages(count) + sizeof(uint64_t) * page * count, align); }
+
+    // Returns the total size of a snapshot with the header's counts, else UINT64_MAX when it does not fit in 64 bits.
+    static uint64_t extent(const index_snapshot_header& header) {
+        uint64_t size = sizeof(index_snapshot_header);
+        if (!index_grow(size, header.pages, sizeof(uint64_t) * (page + 1)) || !index_grow(size, 1, align - 1))
+            return ~uint64_t(0);
+        size = size / align * align;
+        if (!index_grow(size, header.records, record((header.flags & index_options::generations) != 0)) || !index_grow(size, header.lineage, 2 * sizeof(uint64_t)))
+            return ~uint64_t(0);
+        for (uint64_t count : { header.open, header.idle, header.pending, header.queued }) {
+            if (!index_grow(size, count, sizeof(uint64_t)))
+                return ~uint64_t(0);
+        }
+        return size;
+    }
+};
+
+// Snapshot of an index_table's counters and shape returned by stats() (statistics option).
+struct index_stats : index_counters {
+    size_t items = 0;
+    size_t buckets = 0;
+    // Empty buckets retained, and deallocated bucket ranges waiting to be re-used.
+    size_t idle = 0;
+    size_t vacant = 0;
+    size_t capacity = 0;
+    // occupancy[k] is the number of buckets holding exactly k items, for k in [0, S].
+    std::vector<size_t> occupancy;
+    // Fraction of allocated buckets that a perfectly packed table would not need, 0 when packed.
+    double fragmentation = 0.0;
+};
+
+/*
+    Radix tree from bucket indices to buckets <B>, nullptr where no bucket holds the range. Each
+    node has page_size slots and the tree only grows as tall as the highest bucket index needs, so
+    a sparse key space costs a few nodes per occupied region instead of memory for the whole range,
+    and a compact table of up to 2^18 buckets is still two array reads per lookup. Nodes are freed
+    with their last bucket.
+
+    Every node also keeps bitmaps over its slots, so the lowest range without a bucket and the
+    lowest bucket with a free index are found by walking down from the root instead of scanning
+    bitmaps over every range.
+*/
+template<typename B>
+class index_directory {
+    public:
+    static constexpr size_t page_shift = 9;
+    static constexpr size_t page_size = size_t(1) << page_shift;
+
+    private:
+    static constexpr size_t words = page_size / 64;
+    // Levels needed to cover every size_t bucket index.
+    static constexpr size_t max_height = (sizeof(size_t) * 8 + page_shift - 1) / page_shift;
+
+    struct node {
+        // Buckets in leaves, the nodes of the next level down in inner nodes.
+        void* slots[page_size] = {};
+        // Set for each non-null slot.
+        uint64_t present[words] = {};
+        // Set for each slot whose whole range holds buckets (the same as present in leaves).
+        uint64_t full[words] = {};
+        // Set for each slot whose range holds a bucket with a free index.
+        uint64_t open[words] = {};
+    };
+    node* root = nullptr;
+    // Number of levels including the root and the leaves, 0 without a root.
+    size_t height = 0;
+    // Number of bucket indices the tree covers, saturated at SIZE_MAX.
+    size_t reach = 0;
+    // Lowest bucket index with a free index and its bucket (SIZE_MAX and nullptr for none) while hinted, so first() is O(1) between changes.
+    size_t hint = ~size_t(0);
+    B* hinted_bucket = nullptr;
+    bool hinted = false;
+    // Number of bucket indices covered, one past the highest bucket index ever set.
+    size_t extent = 0;
+
+    static size_t digit(size_t bindex, size_t level) { return (bindex >> (page_shift * level)) & (page_size - 1); }
+    static bool test(const uint64_t* bits, size_t i) { return (bits[i / 64] >> (i % 64)) & 1; }
+    static void assign(uint64_t* bits, size_t i, bool on) {
+        if (on)
+            bits[i / 64] |= uint64_t(1) << (i % 64);
+        else
+            bits[i / 64] &= ~(uint64_t(1) << (i % 64));
+    }
+    static bool any(const uint64_t* bits) {
+        for (size_t w = 0; w < words; w++) {
+            if (bits[w] != 0)
+                return true;
+        }
+        return false;
+    }
+    static bool all(const uint64_t* bits) {
+        for (size_t w = 0; w < words; w++) {
+            if (bits[w] != ~uint64_t(0))
+                return false;
+        }
+        return true;
+    }
+    // Returns the lowest set bit at or after <i>, else page_size.
+    static size_t lowest(const uint64_t* bits, size_t i, bool invert = false) {
+        for (size_t w = i / 64; w < words; w++) {
+            uint64_t word = (invert ? ~bits[w] : bits[w]) & (~uint64_t(0) << ((w == i / 64) ? i % 64 : 0));
+            if (word != 0)
+                return w * 64 + index_ctz(word);
+        }
+        return page_size;
+    }
+
+    // Sets the height and the number of bucket indices it covers.
+    void rise(size_t levels) {
+        height = levels;
+        if (height == 0)
+            reach = 0;
+        else
+            reach = (page_shift * height >= sizeof(size_t) * 8) ? ~size_t(0) : size_t(1) << (page_shift * height);
+    }
+
+    // The largest bucket index, SIZE_MAX, is never used since it is past every Index range.
+    bool covers(size_t bindex) const { return bindex < reach; }
+
+    static void destroy(node* n, size_t level) {
+        if (level > 0) {
+            for (size_t i = lowest(n->present, 0); i < page_size; i = lowest(n->present, i + 1))
+                destroy(static_cast<node*>(n->slots[i]), level - 1);
+        }
+        delete n;
+    }
+
+    // Fills path[level] with the nodes from the root down to the leaf of the bucket index, else returns false at a missing node.
+    bool walk(size_t bindex, node** path) const {
+        if (!covers(bindex))
+            return false;
+        node* n = root;
+        for (size_t level = height - 1; level > 0; level--) {
+            path[level] = n;
+            n = static_cast<node*>(n->slots[digit(bindex, level)]);
+            if (n == nullptr)
+                return false;
+        }
+        path[0] = n;
+        return true;
+    }
+
+    // Updates the bitmaps of path[1, height) after the leaf path[0] changed, freeing nodes left empty.
+    void propagate(size_t bindex, node** path) {
+        for (size_t level = 0; level + 1 < height; level++) {
+            node* child = path[level];
+            node* parent = path[level + 1];
+            size_t at = digit(bindex, level + 1);
+            if (!any(child->present)) {
+                delete child;
+                parent->slots[at] = nullptr;
+                assign(parent->present, at, false);
+                assign(parent->full, at, false);
+                assign(parent->open, at, false);
+            } else {
+                assign(parent->full, at, all(child->full));
+                assign(parent->open, at, any(child->open));
+            }
+        }
+        if (!any(root->present)) {
+            delete root;
+            root = nullptr;
+            rise(0);
+        }
+    }
+
+    // Returns the offset of the first bucket at or after offset <from> within the range of the node, else SIZE_MAX.
+    static size_t seek(const node* n, size_t level, size_t from) {
+        size_t shift = page_shift * level;
+        size_t start = from >> shift;
+        for (size_t i = lowest(n->present, start); i < page_size; i = lowest(n->present, i + 1)) {
+            if (level == 0)
+                return i;
+            size_t below = seek(static_cast<const node*>(n->slots[i]), level - 1, (i == start) ? from & ((size_t(1) << shift) - 1) : 0);
+            if (below != ~size_t(0))
+                return (i << shift) | below;
+        }
+        return ~size_t(0);
+    }
+
+    public:
+    index_directory() = default;
+    index_directory(const index_directory&) = delete;
+    index_directory& operator=(const index_directory&) = delete;
+    ~index_directory() { clear(); }
+
+    // Returns the number of bucket indices covered.
+    size_t size() const { return extent; }
+
+    // Returns the bucket at a bucket index, else nullptr.
+    B* operator[](size_t bindex) const {
+        if (!covers(bindex))
+            return nullptr;
+        const node* n = root;
+        for (size_t level = height - 1; level > 0; level--) {
+            n = static_cast<const node*>(n->slots[digit(bindex, level)]);
+            if (n == nullptr)
+                return nullptr;
+        }
+        return static_cast<B*>(n->slots[digit(bindex, 0)]);
+    }
+
+    // Sets the bucket at a bucket index below size(), allocating or freeing nodes as needed. Clearing a bucket also clears its open bit.
+    void set(size_t bindex, B* bckt) {
+        node* path[max_height];
+        if (bckt != nullptr) {
+            // Grow the tree upwards until the root covers the bucket index.
+            while (!covers(bindex)) {
+                node* up = new node();
+                if (root != nullptr) {
+                    up->slots[0] = root;
+                    assign(up->present, 0, true);
+                    assign(up->full, 0, all(root->full));
+                    assign(up->open, 0, any(root->open));
+                }
+                root = up;
+                rise(height + 1);
+            }
+            node* n = root;
+            for (size_t level = height - 1; level > 0; level--) {
+                path[level] = n;
+                size_t at = digit(bindex, level);
+                if (n->slots[at] == nullptr) {
+                    n->slots[at] = new node();
+                    assign(n->present, at, true);
+                }
+                n = static_cast<node*>(n->slots[at]);
+            }
+            path[0] = n;
+        } else if (!walk(bindex, path)) {
+            return;
+        }
+        size_t at = digit(bindex, 0);
+        path[0]->slots[at] = bckt;
+        assign(path[0]->present, at, bckt != nullptr);
+        assign(path[0]->full, at, bckt != nullptr);
+        if (bckt == nullptr) {
+            assign(path[0]->open, at, false);
+            hinted = hinted && hint != bindex;
+        }
+        propagate(bindex, path);
+    }
+
+    // Sets whether the bucket at a bucket index has a free index.
+    void mark(size_t bindex, bool open) {
+        node* path[max_height];
+        if (!walk(bindex, path) || test(path[0]->open, digit(bindex, 0)) == open)
+            return;
+        assign(path[0]->open, digit(bindex, 0), open);
+        if (open && hinted && bindex < hint) {
+            hint = bindex;
+            hinted_bucket = static_cast<B*>(path[0]->slots[digit(bindex, 0)]);
+        } else if (!open) {
+            hinted = hinted && hint != bindex;
+        }
+        for (size_t level = 0; level + 1 < height; level++) {
+            size_t at = digit(bindex, level + 1);
+            bool below = any(path[level]->open);
+            if (test(path[level + 1]->open, at) == below)
+                break;
+            assign(path[level + 1]->open, at, below);
+        }
+    }
+
+    // Returns whether the bucket at a bucket index is marked as having a free index.
+    bool marked(size_t bindex) const {
+        node* path[max_height];
+        return walk(bindex, path) && test(path[0]->open, digit(bindex, 0));
+    }
+
+    // Returns the bucket with the lowest bucket index that has a free index, else nullptr. Adds the bitmap words read to <scanned>.
+    B* first(size_t& scanned) {
+        if (hinted)
+            return hinted_bucket;
+        hinted = true;
+        hint = ~size_t(0);
+        hinted_bucket = nullptr;
+        if (root == nullptr)
+            return nullptr;
+        const node* n = root;
+        size_t bindex = 0;
+        for (size_t level = height - 1;; level--) {
+            size_t at = lowest(n->open, 0);
+            scanned += at / 64 + 1;
+            if (at >= page_size)
+                return nullptr;
+            bindex = (bindex << page_shift) | at;
+            if (level == 0) {
+                hint = bindex;
+                return hinted_bucket = static_cast<B*>(n->slots[at]);
+            }
+            n = static_cast<const node*>(n->slots[at]);
+        }
+    }
+
+    // Returns the lowest bucket index below size() that holds no bucket, else size().
+    size_t vacancy() const {
+        if (root == nullptr)
+            return 0;
+        const node* n = root;
+        size_t bindex = 0;
+        for (size_t level = height - 1;; level--) {
+            size_t at = lowest(n->full, 0, true);
+            if (at >= page_size)
+                return std::min(reach, extent);
+            bindex = (bindex << page_shift) | at;
+            if (level == 0 || n->slots[at] == nullptr)
+                return std::min(bindex << (page_shift * level), extent);
+            n = static_cast<const node*>(n->slots[at]);
+        }
+    }
+
+    // Covers bucket indices up to <size>, new indices hold no bucket.
+    void resize(size_t size) { extent = size; }
+
+    void clear() {
+        if (root != nullptr)
+            destroy(root, height - 1);
+        root = nullptr;
+        rise(0);
+        extent = 0;
+        hinted = false;
+    }
+
+    // Hints the CPU to load the entry of a bucket index.
+    void prefetch(size_t bindex) const {
+        if (!covers(bindex))
+            return;
+        const node* n = root;
+        for (size_t level = height - 1; level > 0; level--) {
+            n = static_cast<const node*>(n->slots[digit(bindex, level)]);
+            if (n == nullptr)
+                return;
+        }
+        index_prefetch(&n->slots[digit(bindex, 0)]);
+    }
+
+    // Returns the lowest bucket index at or after <bindex> that holds a bucket, else size(). Empty subtrees are skipped whole.
+    size_t next(size_t bindex) const {
+        if (!covers(bindex))
+            return extent;
+        size_t found = seek(root, height - 1, bindex);
+        return (found == ~size_t(0)) ? extent : found;
+    }
+};
 
 /*
     Used via index_table<T, S>  to store items at their position in the index_table.
@@ -24,51 +774,205 @@
 
     T: Type of data you want to store.
     S: Size of each bucket's cache for storing items.
+    Options: index_options flags of the owning index_table.
+    Index: Integer type of the owning index_table's indices.
+    Traits: index_traits of the owning index_table.
 */
-template<typename T, size_t S>
-class index_bucket {
+template<typename T, size_t S, unsigned Options = 0, typename Index = int32_t, typename Traits = index_traits<T>>
+class alignas(64) index_bucket {
     public:
-    T items[S];
-    size_t filled;
-    int32_t bucket_index = -1;
+    static constexpr bool generations = (Options & index_options::generations) != 0;
+    static constexpr bool split_keys = (Options & index_options::split_keys) != 0;
+    using key_traits = typename Traits::key;
+    using key_type = typename key_traits::type;
+    using equal = typename Traits::equal;
+    using key_equal = typename Traits::key_equal;
+    // Whether whole words of items, respectively keys, can be matched with the SIMD kernels.
+    static constexpr bool simd_items = index_simd_comparable<T>::value && std::is_same<equal, std::equal_to<T>>::value;
+    static constexpr bool simd_keys = index_simd_comparable<key_type>::value && std::is_same<key_equal, std::equal_to<key_type>>::value;
+    // Number of 64-bit words in the occupancy bitmap.
+    static constexpr size_t words = (S + 63) / 64;
+    // Mask of the valid bits in the last occupancy word.
+    static constexpr uint64_t tail = (S % 64) ? ((uint64_t(1) << (S % 64)) - 1) : ~uint64_t(0);
+
+    /*
+        Header first: the count, bucket index, list links and occupancy bitmap are packed at the
+        start of the 64-byte aligned bucket, so free-index scans and metadata checks only read
+        header cache lines. The items start on a cache line of their own, after the optional key
+        and generation arrays (which take no room in the header when their option is off).
+    */
+    Index bucket_index = Index(-1);
+    index_count<S> filled;
+    // Set while the bucket index is on the table's queue for maintain(), so it is queued at most once (deferred option).
+    bool queued = false;
+    // Position of the bucket in the table's buckets vector, so it can be removed without a search.
+    size_t position = 0;
+    // Position of the bucket in the table's list of retained empty buckets, else -1 when not retained.
+    size_t idle = size_t(-1);
+    // Links in the table's list of buckets with a free index (recent_first option only).
+    index_bucket* next_open = nullptr;
+    index_bucket* prev_open = nullptr;
+    // One bit per item, set when the item's index is in use. This lets T() be a valid item.
+    uint64_t occupancy[words];
+
+    // Key of each item stored apart from the items for scans, unused indices hold key_type() (split_keys option).
+    typename std::conditional<split_keys, key_type[S], index_none>::type keys;
+    // Generation of each index, bumped whenever its item is removed (generations option).
+    typename std::conditional<generations, uint32_t[S], index_none>::type generation;
+
+    // Items are only constructed while their index is in use, so unused indices cost no construction.
+    union {
+        alignas(64) alignas(T) T items[S];
+    };
     
-    // Creates a new index_bucket and fills all of it's items with T().
+    // Creates a new index_bucket with no items constructed.
     index_bucket(size_t bucket_index) {
-        this->bucket_index = bucket_index;
-        std::fill(items, items + S, T());
+        this->bucket_index = static_cast<Index>(bucket_index);
+        std::fill(occupancy, occupancy + words, 0);
+        if constexpr (split_keys)
+            std::fill(keys, keys + S, key_type());
         filled = 0;
     }
 
-    // Gets the first freely available index in the bucket, else null.
-    int32_t get_index() {
-        int32_t index = std::distance(items, std::find_if(std::begin(items), std::end(items), [](T itm) { return (itm == T()); }));
-        return (index != S)? index : -1;
+    // Destroys the items still in the bucket.
+    ~index_bucket() {
+        if constexpr (!std::is_trivially_destructible<T>::value) {
+            for (size_t w = 0; w < words; w++) {
+                for (uint64_t bits = occupancy[w]; bits != 0; bits &= bits - 1)
+                    items[w * 64 + index_ctz(bits)].~T();
+            }
+        }
+    }
+
+    index_bucket(const index_bucket&) = delete;
+    index_bucket& operator=(const index_bucket&) = delete;
+
+    // Returns whether the index in the bucket holds an item.
+    bool occupied(int32_t index) const {
+        return (occupancy[index / 64] >> (index % 64)) & 1;
     }
 
-    // Gets the index of the item if it exists, else null.
-    int32_t item(T item) {
-        int32_t index = std::distance(items, std::find_if(std::begin(items), std::end(items), [item](T itm) { return itm == item; }));
-        return (index != S) ? index : -1;
+    // Gets the first freely available index in the bucket, else -1.
+    int32_t get_index() const {
+        for (size_t w = 0; w < words; w++) {
+            uint64_t free = ~occupancy[w] & ((w == words - 1) ? tail : ~uint64_t(0));
+            if (free != 0)
+                return static_cast<int32_t>(w * 64) + index_ctz(free);
+        }
+        return -1;
+    }
+
+    // Gets the index of the first item with the key, else -1 (split_keys option).
+    // Every key of a word is compared without branching (with the SIMD kernels when possible), then masked by occupancy.
+    int32_t key(const key_type& key) const {
+        static_assert(split_keys, "index_bucket::key requires index_options::split_keys");
+        for (size_t w = 0; w < words; w++) {
+            size_t count = (w == words - 1 && S % 64) ? S % 64 : 64;
+            const key_type* run = keys + w * 64;
+            uint64_t match = 0;
+            if constexpr (simd_keys) {
+                if (count == 64)
+                    match = index_match(run, key);
+            }
+            if (count < 64 || !simd_keys) {
+                for (size_t i = 0; i < count; i++)
+                    match |= uint64_t(key_equal()(run[i], key)) << i;
+            }
+            match &= occupancy[w];
+            if (match != 0)
+                return static_cast<int32_t>(w * 64) + index_ctz(match);
+        }
+        return -1;
+    }
+
+    // Gets the index of the item if it exists, else -1. Under split_keys items are matched by key.
+    int32_t item(const T& item) const {
+        if constexpr (split_keys) {
+            return key(key_traits::get(item));
+        } else {
+            for (size_t w = 0; w < words; w++) {
+                uint64_t bits = occupancy[w];
+                // Full words of plain integers and pointers are compared 64 at a time, unused indices are masked off.
+                if constexpr (simd_items) {
+                    if (bits != 0 && w * 64 + 64 <= S) {
+                        bits &= index_match(items + w * 64, item);
+                        if (bits != 0)
+                            return static_cast<int32_t>(w * 64) + index_ctz(bits);
+                        continue;
+                    }
+                }
+                for (; bits != 0; bits &= bits - 1) {
+                    int32_t index = static_cast<int32_t>(w * 64) + index_ctz(bits);
+                    if (equal()(items[index], item))
+                        return index;
+                }
+            }
+            return -1;
+        }
     }
     
-    // Inserts a new item and returns it's index, else -1.
-    int32_t insert(T item) {
+    // Constructs a new item in place from the arguments and returns it's index, else -1.
+    template<typename... Args>
+    int32_t emplace(Args&&... args) {
         int32_t index = get_index();
-        if (index >= 0 && index < S) {
-            items[index] = item;
-            filled++;
-        }
+        if (index >= 0)
+            emplace_at(index, std::forward<Args>(args)...);
+        return index;
+    }
+
+    // Constructs a new item in place at an index that is not in use and returns the index.
+    template<typename... Args>
+    int32_t emplace_at(int32_t index, Args&&... args) {
+        new (&items[index]) T(std::forward<Args>(args)...);
+        if constexpr (split_keys)
+            keys[index] = key_traits::get(items[index]);
+        occupancy[index / 64] |= uint64_t(1) << (index % 64);
+        filled++;
         return index;
     }
 
+    // Inserts a new item and returns it's index, else -1.
+    int32_t insert(const T& item) { return emplace(item); }
+    int32_t insert(T&& item) { return emplace(std::move(item)); }
+
     // Returns the index of the item that was removed, else -1.
-    int32_t remove(T item) {
-        int32_t index = std::distance(items, std::find_if(std::begin(items), std::end(items), [&item](T src) { return (src == item); }));
-        if (index >= 0) {
-            items[index] = T();
-            filled--;
+    int32_t remove(const T& item) {
+        return erase(this->item(item));
+    }
+
+    // Inserts items from the range into free indices in order until the bucket is full, calling placed(index) for each.
+    // Returns the iterator to the first item that was not inserted.
+    template<typename It, typename F>
+    It fill(It begin, It end, F&& placed) {
+        size_t added = 0;
+        for (size_t w = 0; w < words && begin != end; w++) {
+            uint64_t free = ~occupancy[w] & ((w == words - 1) ? tail : ~uint64_t(0));
+            uint64_t used = 0;
+            for (; free != 0 && begin != end; free &= free - 1, ++begin) {
+                int32_t index = static_cast<int32_t>(w * 64) + index_ctz(free);
+                new (&items[index]) T(*begin);
+                if constexpr (split_keys)
+                    keys[index] = key_traits::get(items[index]);
+                used |= free & (~free + 1);
+                added++;
+                placed(index);
+            }
+            occupancy[w] |= used;
         }
-        return (index != S) ? index : -1;
+        filled = static_cast<index_count<S>>(filled + added);
+        return begin;
+    }
+
+    // Removes the item at the specified index and returns the index, else -1 if it was not in use.
+    int32_t erase(int32_t index) {
+        if (index < 0 || !occupied(index))
+            return -1;
+        items[index].~T();
+        occupancy[index / 64] &= ~(uint64_t(1) << (index % 64));
+        if constexpr (generations)
+            generation[index]++;
+        filled--;
+        return index;
     }
 };
 
@@ -78,152 +982,1289 @@ class index_bucket {
 
     T: Type of data you want to store.
     S: Size of each bucket's cache for storing items.
+    Options: index_options flags selecting optional behavior, default none.
+    Index: Integer type of the indices, default int32_t. Use uint32_t or uint64_t to address
+           more than 2^31 indices; npos (Index(-1)) is returned instead of an index on failure.
+    Alloc: std::allocator compatible allocator (e.g. std::pmr::polymorphic_allocator<T>), rebound
+           to allocate the bucket slabs, default std::allocator<T>.
+    Traits: index_traits giving the key projection, hash and equality of items, default index_traits<T>.
 */
-template<typename T, size_t S>
+template<typename T, size_t S, unsigned Options = 0, typename Index = int32_t, typename Alloc = std::allocator<T>, typename Traits = index_traits<T>>
 class index_table {
+    static_assert(std::is_integral<Index>::value, "index_table requires an integral Index type");
+
     public:
+    static constexpr bool generations = (Options & index_options::generations) != 0;
+    using math = index_math<S>;
+    using bucket_type = index_bucket<T, S, Options, Index, Traits>;
+    using index_type = Index;
+    using allocator_type = Alloc;
+    using traits_type = Traits;
+
+    // Returned in place of an index when there is no item or no free index: -1 for signed types, the max value for unsigned types.
+    static constexpr Index npos = static_cast<Index>(-1);
+
+    // An index paired with the generation it was handed out at (generations option).
+    struct handle {
+        Index index = npos;
+        uint32_t generation = 0;
+    };
+
     // Vector containing all unordered buckets and their items.
-    std::vector<index_bucket<T, S>*> buckets;
+    std::vector<bucket_type*> buckets;
+    /*
+        Forward iterator over the occupied indices of the table in bucket index order, yielding
+        (index, item) pairs. Empty indices are skipped with the occupancy bitmaps, so a full sweep
+        costs O(n + b) instead of testing every index. Inserting or removing items invalidates it.
+    */
+    template<bool Const>
+    class basic_iterator {
+        friend class index_table;
+        using item_type = typename std::conditional<Const, const T, T>::type;
+
+        const index_directory<bucket_type>* directory = nullptr;
+        size_t bindex = size_t(-1);
+        size_t word = bucket_type::words - 1;
+        uint64_t bits = 0;
+
+        // Moves to the next occupied index at or after the current position, else to the end.
+        void settle() {
+            while (bits == 0) {
+                if (++word < bucket_type::words) {
+                    bits = (*directory)[bindex]->occupancy[word];
+                    continue;
+                }
+                bindex = directory->next(bindex + 1);
+                word = 0;
+                if (bindex >= directory->size())
+                    return;
+                bits = (*directory)[bindex]->occupancy[0];
+            }
+        }
+
+        basic_iterator(const index_directory<bucket_type>* directory, bool end) : directory(directory) {
+            if (end) {
+                bindex = directory->size();
+                word = 0;
+            } else {
+                settle();
+            }
+        }
+
+        public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = std::pair<Index, item_type&>;
+        using reference = value_type;
+        using pointer = void;
+        using difference_type = std::ptrdiff_t;
+
+        basic_iterator() = default;
+
+        // Returns the index of the current item.
+        Index index() const { return math::index(static_cast<Index>(bindex), static_cast<int32_t>(word * 64) + index_ctz(bits)); }
+
+        reference operator*() const {
+            return reference(index(), (*directory)[bindex]->items[word * 64 + index_ctz(bits)]);
+        }
+
+        basic_iterator& operator++() {
+            bits &= bits - 1;
+            settle();
+            return *this;
+        }
+
+        basic_iterator operator++(int) {
+            basic_iterator prev = *this;
+            ++*this;
+            return prev;
+        }
+
+        bool operator==(const basic_iterator& other) const { return bindex == other.bindex && word == other.word && bits == other.bits; }
+        bool operator!=(const basic_iterator& other) const { return !(*this == other); }
+    };
+
+    using iterator = basic_iterator<false>;
+    using const_iterator = basic_iterator<true>;
+
     private:
-    // Keeps track of all bucket indices of delete buckets so that the indices can be re-queued for new buckets.
-    std::stack<int32_t> empty;
-    // Tracks the last bucket index for creating buckets when all buckets from 0 to N are full.
-    // This is because the buckets vector can have buckets out of order, so we use this to keep from searching for the highest bucket index via the vector.
-    int32_t bucket_hiindex;
-    
-    // Creates a new bucket with the next freely available range of indices on the stack.
-    index_bucket<T, S>* bucket() {
-        int32_t bindex = -1;
-        index_bucket<T,S>* bckt;
-
-        if (empty.size() > 0) {
-            // This means not all buckets are present and ones have been deleted, freeing up bucket ranges.
-            bindex = empty.top();
-            empty.pop();
+    // Directory of buckets indexed by their bucket index, nullptr where no bucket holds that range.
+    // This gives geti/removei a direct lookup instead of searching the buckets vector, and keeps it sparse for sparse key spaces.
+    // It also tracks the ranges below directory.size() without a bucket (vacant, re-used lowest first so indices stay compact)
+    // and which buckets have a free index (lowest-index-first).
+    index_directory<bucket_type> directory;
+    // Most recently freed bucket with a free index (recent_first option).
+    bucket_type* open_head = nullptr;
+    // Hash index from items to their indices (reverse_lookup option).
+    static constexpr bool reverse_lookup = (Options & index_options::reverse_lookup) != 0;
+    static constexpr bool statistics = (Options & index_options::statistics) != 0;
+    static constexpr bool deferred = (Options & index_options::deferred) != 0;
+    typename std::conditional<reverse_lookup, std::unordered_multimap<T, Index, typename Traits::hash, typename Traits::equal>, index_none>::type reverse;
+    // Allocator for the bucket slabs, rebound from Alloc.
+    using bucket_allocator = typename std::allocator_traits<Alloc>::template rebind_alloc<bucket_type>;
+    bucket_allocator allocator;
+    // Contiguous chunks of bucket storage owned by the table, so buckets are not allocated one at a time.
+    std::vector<std::pair<bucket_type*, size_t>> slabs;
+    // Bucket storage in the slabs that does not hold a live bucket, re-used before allocating a new slab.
+    std::vector<bucket_type*> spare;
+    // Total number of buckets the slabs can hold.
+    size_t slab_capacity = 0;
+    // Smallest number of buckets allocated per slab.
+    static constexpr size_t slab_min = 8;
+    // Number of indices geti_many prefetches ahead of the one it resolves.
+    static constexpr size_t lookahead = 16;
+    // Highest bucket index whose whole range of indices fits in Index without reaching npos.
+    static constexpr size_t max_bucket = (static_cast<size_t>(std::numeric_limits<Index>::max()) - (std::is_signed<Index>::value ? 0 : 1) - (S - 1)) / S;
+    // Number of bucket ranges new buckets may be created in, lowered by limit().
+    size_t bucket_limit = max_bucket + 1;
+    // Empty buckets kept alive instead of being deallocated, see retain().
+    std::vector<bucket_type*> idle;
+    // Number of empty buckets left retained once idle grows past retain_high.
+    size_t retain_low = 0;
+    // Number of empty buckets that may be retained before any are deallocated.
+    size_t retain_high = 0;
+    // Bucket indices of buckets emptied by removals and not yet handed to emptied() (deferred option).
+    typename std::conditional<deferred, std::vector<size_t>, index_none>::type pending;
+    // Number of items in all buckets, kept up to date by every insert and remove.
+    size_t items_count = 0;
+    // Hot-path event counters (statistics option).
+    typename std::conditional<statistics, index_counters, index_none>::type counters;
+    // Generation each bucket index starts its indices at, so generations keep counting up across bucket re-creation (generations option).
+    // Only bucket indices whose bucket was deallocated have an entry, so sparse tables store no generations for unused ranges.
+    typename std::conditional<generations, std::map<size_t, uint32_t>, index_none>::type lineage;
+
+    // Allocates a new slab holding the number of buckets and queues its storage as spare.
+    void grow(size_t count) {
+        bucket_type* slab = std::allocator_traits<bucket_allocator>::allocate(allocator, count);
+        slabs.emplace_back(slab, count);
+        if constexpr (statistics)
+            counters.slabs++;
+        slab_capacity += count;
+        spare.reserve(slab_capacity);
+        // Queue in reverse so buckets are handed out in address order.
+        for (size_t i = count; i > 0; i--)
+            spare.push_back(slab + (i - 1));
+    }
+
+    // Constructs a bucket in spare slab storage, allocating a new slab (doubling the capacity) only when none is spare.
+    bucket_type* acquire(size_t bindex) {
+        if (spare.empty())
+            grow(std::max(slab_min, slab_capacity));
+        bucket_type* bckt = spare.back();
+        spare.pop_back();
+        return new (bckt) bucket_type(bindex);
+    }
+
+    // Destroys a bucket and returns its storage to the spare list.
+    void recycle(bucket_type* bckt) {
+        bckt->~bucket_type();
+        spare.push_back(bckt);
+    }
+
+    // Marks the bucket as having a free index. Under recent_first this also moves it to the front.
+    void opened(bucket_type* bckt, bool linked) {
+        if (Options & index_options::recent_first) {
+            if (linked) {
+                if (open_head == bckt)
+                    return;
+                closed(bckt);
+            }
+            bckt->next_open = open_head;
+            bckt->prev_open = nullptr;
+            if (open_head != nullptr)
+                open_head->prev_open = bckt;
+            open_head = bckt;
         } else {
-            if (buckets.size() > 0) {
-                // This means all bucket ranges are present, so just create a new bucket at the end range.
-                bindex = bucket_hiindex + 1;
-                bucket_hiindex = bindex;
-            } else {
-                // No buckets are present, so create a new bucket starting at the [0 ... S] range.
-                bindex = 0;
+            directory.mark(static_cast<size_t>(bckt->bucket_index), true);
+        }
+    }
+
+    // Marks the bucket as having no free index, or removes it from the free list when released.
+    void closed(bucket_type* bckt) {
+        if (Options & index_options::recent_first) {
+            if (bckt->prev_open != nullptr)
+                bckt->prev_open->next_open = bckt->next_open;
+            else
+                open_head = bckt->next_open;
+            if (bckt->next_open != nullptr)
+                bckt->next_open->prev_open = bckt->prev_open;
+            bckt->next_open = bckt->prev_open = nullptr;
+        } else {
+            directory.mark(static_cast<size_t>(bckt->bucket_index), false);
+        }
+    }
+
+    // Retains a bucket that just became empty, deallocating retained buckets down to retain_low past retain_high.
+    void emptied(bucket_type* bckt) {
+        bckt->idle = idle.size();
+        idle.push_back(bckt);
+        if constexpr (statistics)
+            counters.retained += idle.size() <= retain_high;
+        if (idle.size() > retain_high)
+            trim(retain_low);
+    }
+
+    // Retains or deallocates a bucket a removal just emptied, or queues it for maintain() (deferred option).
+    void vacated(bucket_type* bckt) {
+        if constexpr (deferred) {
+            if (!bckt->queued)
+                pending.push_back(bckt->bucket_index);
+            bckt->queued = true;
+        } else
+            emptied(bckt);
+    }
+
+    // Removes a bucket from the retained empty buckets, because it is being filled or deallocated.
+    void unidle(bucket_type* bckt) {
+        if (bckt->idle == size_t(-1))
+            return;
+        idle[bckt->idle] = idle.back();
+        idle[bckt->idle]->idle = bckt->idle;
+        idle.pop_back();
+        bckt->idle = size_t(-1);
+    }
+
+    // Takes an empty bucket that is about to be filled off the retained empty buckets.
+    void revive(bucket_type* bckt) {
+        if constexpr (statistics)
+            counters.revived += bckt->idle != size_t(-1);
+        unidle(bckt);
+    }
+
+    // Deallocates retained empty buckets until at most the number are left.
+    void trim(size_t keep) {
+        while (idle.size() > keep)
+            release(idle.back());
+    }
+
+    // Returns whether the bucket is on the free list.
+    bool listed(bucket_type* bckt) {
+        if (Options & index_options::recent_first)
+            return open_head == bckt || bckt->prev_open != nullptr;
+        return directory.marked(static_cast<size_t>(bckt->bucket_index));
+    }
+
+    // Removes the item's entry for the index from the reverse lookup (reverse_lookup option).
+    void unmap(const T& item, Index index) {
+        if constexpr (reverse_lookup) {
+            auto range = reverse.equal_range(item);
+            for (auto iter = range.first; iter != range.second; ++iter) {
+                if (iter->second == index) {
+                    reverse.erase(iter);
+                    break;
+                }
             }
         }
+    }
+
+    // Removes the item at the slot of the bucket, updating the free list and retaining or releasing the bucket if it is empty.
+    T take(bucket_type* bckt, int32_t slot) {
+        bool was_full = bckt->filled >= S;
+        unmap(bckt->items[slot], math::index(bckt->bucket_index, slot));
+        T item = std::move(bckt->items[slot]);
+        bckt->erase(slot);
+        items_count--;
+
+        opened(bckt, !was_full);
+        // If the bucket has no items, retain it or delete it.
+        if (bckt->filled <= 0)
+            vacated(bckt);
+        return item;
+    }
+    
+    // Returns the lowest bucket index with no bucket, either a deleted range or the next range past the directory.
+    size_t vacancy() {
+        return directory.vacancy();
+    }
+
+    // Creates a new bucket with the lowest freely available range of indices, else nullptr once the ranges exceed Index.
+    bucket_type* bucket() {
+        return materialize(vacancy());
+    }
 
-        bckt = new index_bucket<T, S>(bindex);
+    // Creates a new bucket for the range of a bucket index that holds no bucket, else nullptr past the ranges Index (or limit()) allows.
+    bucket_type* materialize(size_t bindex) {
+        bucket_type* bckt;
+
+        if (bindex >= bucket_limit)
+            return nullptr;
+
+        bckt = acquire(bindex);
+        if constexpr (statistics)
+            counters.created++;
+        bckt->position = buckets.size();
         buckets.push_back(bckt);
+
+        // Ranges skipped over hold no bucket, so they are vacant and handed out first.
+        if (directory.size() <= bindex)
+            directory.resize(bindex + 1);
+        directory.set(bindex, bckt);
+        opened(bckt, false);
+
+        if constexpr (generations) {
+            auto found = lineage.find(bindex);
+            std::fill(bckt->generation, bckt->generation + S, (found != lineage.end()) ? found->second : 0);
+        }
         return bckt;
     }
 
-    // Returns the first bucket with a free index.
-    index_bucket<T, S>* first() {
-        auto iter = std::find_if(buckets.begin(), buckets.end(), [](index_bucket<T, S>* bckt) { return bckt->filled < S; });
-        if (iter == buckets.end())
-            return nullptr;
-        return buckets[iter - buckets.begin()];
+    // Returns the bucket that holds the range of the specified index, else nullptr.
+    bucket_type* locate(Index index) {
+        if constexpr (std::is_signed<Index>::value) {
+            if (index < 0)
+                return nullptr;
+        }
+        size_t bindex = static_cast<size_t>(math::bucket(index));
+        return (bindex < directory.size()) ? directory[bindex] : nullptr;
+    }
+
+    // Removes an empty bucket from the table and queues its range for re-use.
+    void release(bucket_type* bckt) {
+        closed(bckt);
+        unidle(bckt);
+        buckets[bckt->position] = buckets.back();
+        buckets[bckt->position]->position = bckt->position;
+        buckets.pop_back();
+        directory.set(static_cast<size_t>(bckt->bucket_index), nullptr);
+        if constexpr (generations)
+            lineage[static_cast<size_t>(bckt->bucket_index)] = *std::max_element(bckt->generation, bckt->generation + S) + 1;
+        if constexpr (statistics)
+            counters.released++;
+        recycle(bckt);
+    }
+
+    // Returns the first bucket with a free index: the lowest bucket index, or the most recently freed under recent_first.
+    bucket_type* first() {
+        if constexpr (statistics)
+            counters.searches++;
+        if (Options & index_options::recent_first)
+            return open_head;
+
+        size_t scanned = 0;
+        bucket_type* bckt = directory.first(scanned);
+        if constexpr (statistics)
+            counters.scanned += scanned;
+        return bckt;
+    }
+
+    /*
+        Restores a loaded snapshot's order section (see index_snapshot_header): the recent_first
+        free list order, the retained empty buckets in their saved order and the deferred queue.
+        Empty buckets the section does not account for, e.g. in a snapshot saved without the
+        deferred option, are retained or queued as if a removal had just emptied them. Returns
+        false if the section names a range without a suitable loaded bucket.
+    */
+    bool reorder(const index_snapshot_header& header, const std::vector<uint64_t>& order) {
+        auto bucket_at = [this](uint64_t bindex) { return (bindex < directory.size()) ? directory[static_cast<size_t>(bindex)] : nullptr; };
+
+        // Check every entry before changing anything. Queue entries may be stale, maintain() skips them.
+        std::vector<bucket_type*> found(order.size());
+        size_t open_end = static_cast<size_t>(header.open);
+        size_t idle_end = open_end + static_cast<size_t>(header.idle);
+        size_t pending_end = idle_end + static_cast<size_t>(header.pending);
+        for (size_t i = 0; i < order.size(); i++) {
+            found[i] = bucket_at(order[i]);
+            if (i < pending_end && i >= idle_end) {
+                if (order[i] >= directory.size())
+                    return false;
+                continue;
+            }
+            if (found[i] == nullptr || (i < open_end && found[i]->filled >= S) || (i >= open_end && i < idle_end && found[i]->filled != 0))
+                return false;
+        }
+
+        if (Options & index_options::recent_first) {
+            // Moving each bucket to the front, the saved head goes last.
+            for (size_t i = open_end; i > 0; i--)
+                opened(found[i - 1], true);
+        }
+        if constexpr (deferred) {
+            pending.assign(order.data() + idle_end, order.data() + pending_end);
+            for (size_t i = pending_end; i < order.size(); i++)
+                found[i]->queued = true;
+        }
+        for (size_t i = open_end; i < idle_end; i++) {
+            if (found[i]->idle != size_t(-1))
+                return false;
+            found[i]->idle = idle.size();
+            idle.push_back(found[i]);
+        }
+        if (idle.size() > retain_high)
+            trim(retain_low);
+
+        std::vector<bucket_type*> empty;
+        for (bucket_type* bckt : buckets) {
+            if (bckt->filled == 0 && bckt->idle == size_t(-1) && !bckt->queued)
+                empty.push_back(bckt);
+        }
+        std::sort(empty.begin(), empty.end(), [](bucket_type* a, bucket_type* b) { return a->bucket_index < b->bucket_index; });
+        for (bucket_type* bckt : empty)
+            vacated(bckt);
+        return true;
     }
 
     public:
-    // Create a table with a number of pre-existing buckets as "cache."
-    index_table(int32_t cache) {
-        // Set the highest found bucket index in the table to 0 (no buckets).
-        bucket_hiindex = 0;
+    // Create a table with a number of pre-existing buckets as "cache," allocated as one slab from the allocator.
+    index_table(int32_t cache, const Alloc& alloc = Alloc()) : allocator(alloc) {
+        if (cache > 0)
+            grow(cache);
+        buckets.reserve(std::max<int32_t>(cache, 0));
         for(int32_t i = 0; i < cache; i++)
             bucket();
     }
 
+    // Buckets are owned by the table's slabs, so the table cannot be copied.
+    index_table(const index_table&) = delete;
+    index_table& operator=(const index_table&) = delete;
+
+    // Destroys all live buckets and frees the slabs.
+    ~index_table() {
+        for (bucket_type* bckt : buckets)
+            bckt->~bucket_type();
+        for (auto& slab : slabs)
+            std::allocator_traits<bucket_allocator>::deallocate(allocator, slab.first, slab.second);
+    }
+
+    // Returns a copy of the allocator the table was created with.
+    allocator_type get_allocator() const { return allocator_type(allocator); }
+
+    /*
+        Pre-allocates bucket storage and bookkeeping for at least <items> items, so the table can
+        grow to that size without another allocator call for bucket storage. The storage is
+        allocated as one slab; buckets are still only constructed as items need them, and
+        directory nodes are allocated as their ranges are first used.
+    */
+    void reserve(size_t items) {
+        size_t need = (items + S - 1) / S;
+        if (need > buckets.size() + spare.size())
+            grow(need - buckets.size() - spare.size());
+        buckets.reserve(need);
+        idle.reserve(need);
+        if constexpr (reverse_lookup)
+            reverse.reserve(items);
+    }
+
+    /*
+        Caps the indices the table hands out at <highest>, so insert returns npos once every
+        index up to it is in use, like it does at the end of Index. Only whole buckets are
+        created, so the cap rounds down to the end of a bucket range. Set it before inserting:
+        buckets that already exist past the cap keep being used by insert and insert_at, only
+        creating new buckets past it is refused.
+    */
+    void limit(Index highest) {
+        size_t ranges = 0;
+        if constexpr (std::is_signed<Index>::value) {
+            if (highest < 0) {
+                bucket_limit = 0;
+                return;
+            }
+        }
+        if (static_cast<size_t>(highest) >= S - 1)
+            ranges = std::min((static_cast<size_t>(highest) - (S - 1)) / S, max_bucket) + 1;
+        bucket_limit = ranges;
+    }
+
+    /*
+        Sets how many empty buckets are kept alive instead of being deallocated. Once more than
+        <high> buckets are empty, empty buckets are deallocated until only <low> remain, so a
+        workload oscillating around a bucket boundary does not free and re-create a bucket on
+        every insert/remove. retain(k, k) keeps k empty buckets warm; retain(0, 0) is the default
+        and deallocates a bucket as soon as it is empty.
+    */
+    void retain(size_t low, size_t high) {
+        retain_low = low;
+        retain_high = std::max(low, high);
+        if (idle.size() > retain_high)
+            trim(retain_low);
+    }
+
+    /*
+        Retains or deallocates up to <budget> of the buckets that removals emptied since the last
+        call (deferred option), so that work runs when the caller has time for it instead of
+        inside remove. Buckets that were refilled or deallocated in the meantime are skipped.
+        Returns the number of queued buckets that were still empty. Without the deferred option
+        this does nothing.
+    */
+    size_t maintain(size_t budget = size_t(-1)) {
+        size_t settled = 0;
+        if constexpr (deferred) {
+            for (; budget > 0 && !pending.empty(); budget--) {
+                size_t bindex = pending.back();
+                pending.pop_back();
+                bucket_type* bckt = (bindex < directory.size()) ? directory[bindex] : nullptr;
+                if (bckt == nullptr)
+                    continue;
+                bckt->queued = false;
+                // A bucket released and re-created at the same range may also be queued twice, it is already idle the second time.
+                if (bckt->filled > 0 || bckt->idle != size_t(-1))
+                    continue;
+                emptied(bckt);
+                settled++;
+            }
+        }
+        return settled;
+    }
+
+    // Deallocates all retained empty buckets and frees any slab that no longer holds a live bucket.
+    void shrink_to_fit() {
+        maintain();
+        trim(0);
+
+        std::sort(spare.begin(), spare.end(), std::less<bucket_type*>());
+        auto kept = slabs.begin();
+        for (auto& slab : slabs) {
+            auto lo = std::lower_bound(spare.begin(), spare.end(), slab.first, std::less<bucket_type*>());
+            auto hi = std::lower_bound(lo, spare.end(), slab.first + slab.second, std::less<bucket_type*>());
+            if (static_cast<size_t>(hi - lo) == slab.second) {
+                spare.erase(lo, hi);
+                slab_capacity -= slab.second;
+                std::allocator_traits<bucket_allocator>::deallocate(allocator, slab.first, slab.second);
+            } else {
+                *kept++ = slab;
+            }
+        }
+        slabs.erase(kept, slabs.end());
+        // Hand out the lowest addresses first again.
+        std::reverse(spare.begin(), spare.end());
+
+        buckets.shrink_to_fit();
+        spare.shrink_to_fit();
+        idle.shrink_to_fit();
+    }
+
+    /*
+        Moves items out of the sparsest buckets into the densest buckets that still have free
+        indices, then deallocates the emptied buckets. A bucket is only drained when the other
+        buckets have room for all of its items, so every move helps free a bucket. Each move is
+        reported as remap(old_index, new_index) so external references can be fixed up.
+
+        <budget> bounds the number of items moved per call for incremental compaction; calling
+        again continues where the last call stopped. Returns the number of items moved.
+    */
+    template<typename F>
+    size_t compact(F&& remap, size_t budget = size_t(-1)) {
+        // Sparsest buckets first, preferring to drain high bucket indices so the key space shrinks.
+        std::vector<bucket_type*> order(buckets);
+        std::sort(order.begin(), order.end(), [](bucket_type* a, bucket_type* b) {
+            return (a->filled != b->filled) ? a->filled < b->filled : a->bucket_index > b->bucket_index;
+        });
+
+        size_t lo = 0, hi = order.size(), moved = 0;
+        // Free indices in the candidate destinations order[lo + 1, hi).
+        size_t room = 0;
+        for (size_t k = 1; k < hi; k++)
+            room += S - order[k]->filled;
+
+        while (lo < hi && moved < budget) {
+            bucket_type* src = order[lo];
+            if (src->filled > room)
+                break;
+
+            Index base = math::index(src->bucket_index, 0);
+            for (size_t w = 0; w < src->words && moved < budget; w++) {
+                for (uint64_t bits = src->occupancy[w]; bits != 0 && moved < budget; bits &= bits - 1) {
+                    while (order[hi - 1]->filled >= S)
+                        hi--;
+                    bucket_type* dst = order[hi - 1];
+
+                    int32_t from = static_cast<int32_t>(w * 64) + index_ctz(bits);
+                    int32_t slot = dst->emplace(std::move(src->items[from]));
+                    Index to = math::index(dst->bucket_index, slot);
+                    if constexpr (reverse_lookup) {
+                        unmap(dst->items[slot], base + from);
+                        reverse.emplace(dst->items[slot], to);
+                    }
+                    src->erase(from);
+                    if (dst->filled >= S)
+                        closed(dst);
+
+                    room--;
+                    moved++;
+                    if constexpr (statistics)
+                        counters.moved++;
+                    remap(base + from, to);
+                }
+            }
+
+            // Stop inside a partly drained bucket when the budget runs out, it stays on the free list.
+            if (src->filled > 0)
+                break;
+            release(src);
+            if (++lo < hi)
+                room -= S - order[lo]->filled;
+        }
+        return moved;
+    }
+
+    // Removes every item and deallocates every bucket, keeping the slabs' storage for re-use.
+    void clear() {
+        while (!buckets.empty())
+            release(buckets.back());
+        if constexpr (reverse_lookup)
+            reverse.clear();
+        items_count = 0;
+        directory.clear();
+        if constexpr (deferred)
+            pending.clear();
+    }
+
+    /*
+        Writes a binary snapshot of the table (see index_snapshot_header) that load() restores
+        with every item at the same index. Requires a trivially copyable T. Returns whether the
+        stream is still good.
+    */
+    bool save(std::ostream& out) const {
+        static_assert(std::is_trivially_copyable<T>::value, "index_table::save requires a trivially copyable T");
+        using layout = index_snapshot_layout<T, S>;
+
+        index_snapshot_header header = {};
+        std::memcpy(header.magic, index_snapshot_header::signature, sizeof(header.magic));
+        header.version = index_snapshot_header::current;
+        header.flags = generations ? unsigned(index_options::generations) : 0u;
+        header.item_size = sizeof(T);
+        header.item_align = alignof(T);
+        header.bucket_size = S;
+        header.index_size = sizeof(Index);
+        header.items = items_count;
+        header.records = buckets.size();
+        header.directory = directory.size();
+        if constexpr (generations)
+            header.lineage = lineage.size();
+
+        // The free list order (lowest bucket index first needs none), retained buckets and maintain() queue, see reorder().
+        std::vector<uint64_t> order;
+        if (Options & index_options::recent_first) {
+            for (const bucket_type* bckt = open_head; bckt != nullptr; bckt = bckt->next_open)
+                order.push_back(static_cast<uint64_t>(bckt->bucket_index));
+        }
+        header.open = order.size();
+        for (const bucket_type* bckt : idle)
+            order.push_back(static_cast<uint64_t>(bckt->bucket_index));
+        header.idle = idle.size();
+        if constexpr (deferred) {
+            order.insert(order.end(), pending.begin(), pending.end());
+            header.pending = pending.size();
+            for (size_t i = directory.next(0); i < directory.size(); i = directory.next(i + 1)) {
+                if (directory[i]->queued) {
+                    order.push_back(i);
+                    header.queued++;
+                }
+            }
+        }
+
+        // List the pages that hold a bucket and number the records within them.
+        std::vector<uint64_t> table;
+        std::vector<uint64_t> records;
+        for (size_t i = directory.next(0), n = 0; i < directory.size(); i = directory.next(i + 1), n++) {
+            if (table.empty() || table.back() != i / layout::page) {
+                table.push_back(i / layout::page);
+                records.resize(records.size() + layout::page, ~uint64_t(0));
+            }
+            records[records.size() - layout::page + i % layout::page] = n;
+        }
+        header.pages = table.size();
+
+        std::vector<char> buffer(layout::records(table.size()), 0);
+        std::memcpy(buffer.data(), &header, sizeof(header));
+        if (!table.empty()) {
+            std::memcpy(buffer.data() + sizeof(header), table.data(), sizeof(uint64_t) * table.size());
+            std::memcpy(buffer.data() + layout::pages(table.size()), records.data(), sizeof(uint64_t) * records.size());
+        }
+        out.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+
+        buffer.assign(layout::record(generations), 0);
+        for (size_t i = directory.next(0); i < directory.size(); i = directory.next(i + 1)) {
+            const bucket_type* bckt = directory[i];
+            std::fill(buffer.begin(), buffer.end(), 0);
+            uint64_t bindex = static_cast<uint64_t>(bckt->bucket_index);
+            std::memcpy(buffer.data(), &bindex, sizeof(bindex));
+            std::memcpy(buffer.data() + sizeof(bindex), bckt->occupancy, sizeof(bckt->occupancy));
+            // Only occupied items are copied, unused indices are written as zero bytes.
+            for (size_t w = 0; w < bckt->words; w++) {
+                for (uint64_t bits = bckt->occupancy[w]; bits != 0; bits &= bits - 1) {
+                    size_t slot = w * 64 + index_ctz(bits);
+                    std::memcpy(buffer.data() + layout::items + sizeof(T) * slot, &bckt->items[slot], sizeof(T));
+                }
+            }
+            if constexpr (generations)
+                std::memcpy(buffer.data() + layout::generation, bckt->generation, sizeof(uint32_t) * S);
+            out.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+        }
+
+        if constexpr (generations) {
+            for (const auto& entry : lineage) {
+                uint64_t pair[2] = { entry.first, entry.second };
+                out.write(reinterpret_cast<const char*>(pair), sizeof(pair));
+            }
+        }
+        if (!order.empty())
+            out.write(reinterpret_cast<const char*>(order.data()), static_cast<std::streamsize>(sizeof(uint64_t) * order.size()));
+        return out.good();
+    }
+
+    /*
+        Replaces the contents of the table with a snapshot written by save(), restoring every item
+        at its saved index along with the vacant bucket ranges, the free list order, the retained
+        buckets and the maintain() queue. With the same options, retain() and limit() settings the
+        restored table hands out the same indices as the saved one. The snapshot must come from a table
+        with the same T, S and Index and the same generations option. Returns false and leaves the
+        table empty, with its bucket storage freed, if the snapshot does not match or the stream
+        ends early. Counts in the header are checked against the stream length (when it can seek)
+        or against the bytes actually read before anything is sized from them.
+    */
+    bool load(std::istream& in) {
+        static_assert(std::is_trivially_copyable<T>::value, "index_table::load requires a trivially copyable T");
+        using layout = index_snapshot_layout<T, S>;
+        clear();
+
+        index_snapshot_header header;
+        if (!in.read(reinterpret_cast<char*>(&header), sizeof(header)))
+            return false;
+        if (std::memcmp(header.magic, index_snapshot_header::signature, sizeof(header.magic)) != 0 || header.version != index_snapshot_header::current
+            || header.flags != (generations ? unsigned(index_options::generations) : 0u) || header.item_size != sizeof(T) || header.item_align != alignof(T)
+            || header.bucket_size != S || header.index_size != sizeof(Index) || header.records > header.directory || header.directory > bucket_limit)
+            return false;
+
+        // Every written page holds at least one record.
+        uint64_t extent = layout::extent(header);
+        if (header.pages > header.records || extent == ~uint64_t(0))
+            return false;
+        // Nothing is sized from the header until the stream is known to hold the whole snapshot, so a
+        // corrupt count fails here instead of allocating. Unseekable streams size the table as records arrive.
+        std::streampos start = in.tellg();
+        if (start != std::streampos(-1) && in.seekg(0, std::ios::end)) {
+            std::streamoff left = in.tellg() - start;
+            if (!in.seekg(start) || static_cast<uint64_t>(left) + sizeof(header) < extent)
+                return false;
+            reserve(static_cast<size_t>(header.records) * S);
+        }
+        in.clear(in.rdstate() & ~std::ios::failbit);
+
+        // The directory is implied by the records' bucket indices, so it is skipped.
+        if (!index_skip(in, layout::records(static_cast<size_t>(header.pages)) - sizeof(header)))
+            return false;
+
+        std::vector<char> buffer(layout::record(generations), 0);
+        uint64_t loaded = 0;
+        for (; loaded < header.records; loaded++) {
+            uint64_t bindex;
+            if (!in.read(buffer.data(), static_cast<std::streamsize>(buffer.size())))
+                break;
+            std::memcpy(&bindex, buffer.data(), sizeof(bindex));
+            if (bindex >= header.directory || (bindex < directory.size() && directory[bindex] != nullptr))
+                break;
+
+            bucket_type* bckt = materialize(static_cast<size_t>(bindex));
+            std::memcpy(bckt->occupancy, buffer.data() + sizeof(bindex), sizeof(bckt->occupancy));
+            bckt->occupancy[bckt->words - 1] &= bucket_type::tail;
+            std::memcpy(static_cast<void*>(bckt->items), buffer.data() + layout::items, sizeof(T) * S);
+            if constexpr (generations)
+                std::memcpy(bckt->generation, buffer.data() + layout::generation, sizeof(uint32_t) * S);
+
+            Index base = math::index(bckt->bucket_index, 0);
+            size_t filled = 0;
+            for (size_t w = 0; w < bckt->words; w++) {
+                filled += index_popcount(bckt->occupancy[w]);
+                for (uint64_t bits = bckt->occupancy[w]; bits != 0; bits &= bits - 1) {
+                    int32_t slot = static_cast<int32_t>(w * 64) + index_ctz(bits);
+                    if constexpr ((Options & index_options::split_keys) != 0)
+                        bckt->keys[slot] = Traits::key::get(bckt->items[slot]);
+                    if constexpr (reverse_lookup)
+                        reverse.emplace(bckt->items[slot], base + slot);
+                }
+            }
+            bckt->filled = static_cast<index_count<S>>(filled);
+            items_count += filled;
+            // Empty buckets are retained or queued by reorder() in their saved order.
+            if (filled >= S)
+                closed(bckt);
+        }
+
+        // Ranges past the last saved bucket are part of the saved directory and stay vacant.
+        if (loaded == header.records && header.directory > directory.size())
+            directory.resize(static_cast<size_t>(header.directory));
+
+        // extent() checked every count, so the section sizes below cannot overflow.
+        bool whole = loaded == header.records;
+        std::vector<uint64_t> saved;
+        if constexpr (generations) {
+            whole = whole && index_read(in, 2 * header.lineage, saved);
+            // Generations only count up, so ranges re-used since the snapshot keep the higher one.
+            for (size_t i = 0; whole && i < saved.size(); i += 2) {
+                uint32_t& restart = lineage[static_cast<size_t>(saved[i])];
+                restart = std::max(restart, static_cast<uint32_t>(saved[i + 1]));
+            }
+        } else {
+            whole = whole && index_skip(in, 2 * sizeof(uint64_t) * header.lineage);
+        }
+        whole = whole && index_read(in, header.open + header.idle + header.pending + header.queued, saved) && reorder(header, saved);
+
+        // Also free the storage reserved for the snapshot, since the table is left empty.
+        if (!whole || !in) {
+            clear();
+            shrink_to_fit();
+            return false;
+        }
+        return true;
+    }
+
+    // Compacts the table fully and returns every (old_index, new_index) move made.
+    std::vector<std::pair<Index, Index>> compact() {
+        std::vector<std::pair<Index, Index>> moves;
+        compact([&moves](Index from, Index to) { moves.emplace_back(from, to); });
+        return moves;
+    }
+
     // Returns the number of allocated items in all buckets.
-    size_t count() { return std::accumulate(buckets.begin(), buckets.end(), 0, [](size_t val, index_bucket<T, S>* bckt) { return val + bckt->filled; }); }
+    size_t count() const { return items_count; }
+
+    // Returns the number of allocated buckets, including retained empty buckets.
+    size_t bucket_count() const { return buckets.size(); }
+
+    // Returns the number of items the allocated buckets can hold without allocating another bucket.
+    size_t capacity() const { return buckets.size() * S; }
+
+    // Returns a snapshot of the event counters, the bucket occupancy histogram and fragmentation (statistics option).
+    index_stats stats() const {
+        static_assert(statistics, "index_table::stats requires index_options::statistics");
+        index_stats snapshot;
+        static_cast<index_counters&>(snapshot) = counters;
+        snapshot.items = items_count;
+        snapshot.buckets = buckets.size();
+        snapshot.idle = idle.size();
+        snapshot.vacant = directory.size() - buckets.size();
+        snapshot.capacity = capacity();
+        snapshot.occupancy.assign(S + 1, 0);
+        for (const bucket_type* bckt : buckets)
+            snapshot.occupancy[bckt->filled]++;
+        if (!buckets.empty())
+            snapshot.fragmentation = static_cast<double>(buckets.size() - (items_count + S - 1) / S) / static_cast<double>(buckets.size());
+        return snapshot;
+    }
+
+    // Returns count() / capacity(), or 0 when no bucket is allocated.
+    double load_factor() const { return buckets.empty() ? 0.0 : static_cast<double>(items_count) / static_cast<double>(capacity()); }
 
     // Returns the static bucket size.
-    size_t sizeb() { return S; }
+    static constexpr size_t sizeb() { return S; }
 
     // Returns the size the items <T>.
-    size_t sizei() { return sizeof(T); }
+    static constexpr size_t sizei() { return sizeof(T); }
+
+    // Constructs a new item in place in the index table from the arguments, else returns npos when every index is in use.
+    template<typename... Args>
+    Index emplace(Args&&... args) {
+        bucket_type* bckt = first();
+
+        if (bckt == nullptr && (bckt = bucket()) == nullptr)
+            return npos;
+
+        if (bckt->filled == 0)
+            revive(bckt);
+
+        int32_t slot = bckt->emplace(std::forward<Args>(args)...);
+        Index index = math::index(bckt->bucket_index, slot);
+        items_count++;
+
+        // Take the bucket off the free list once its last index is used.
+        if (bckt->filled >= S)
+            closed(bckt);
+
+        if constexpr (reverse_lookup)
+            reverse.emplace(bckt->items[slot], index);
+
+        return index;
+    }
 
     // Inserts a new item into the index table.
-    int32_t insert(T item) {
-        index_bucket<T, S>* bckt = first();
+    Index insert(const T& item) { return emplace(item); }
+    Index insert(T&& item) { return emplace(std::move(item)); }
+
+    /*
+        Constructs a new item in place at a chosen index, creating the bucket for its range if it
+        does not exist yet. Returns the index, else npos if the index is already in use or out of
+        range. Ranges skipped over by a new bucket become vacant, so insert() creates its next
+        buckets there rather than past the highest bucket index.
+    */
+    template<typename... Args>
+    Index emplace_at(Index index, Args&&... args) {
+        if constexpr (std::is_signed<Index>::value) {
+            if (index < 0)
+                return npos;
+        }
+        if (index == npos)
+            return npos;
+
+        // Past limit() only buckets that already exist are filled, materialize() refuses to create new ones.
+        bucket_type* bckt = locate(index);
+        if (bckt == nullptr && (bckt = materialize(static_cast<size_t>(math::bucket(index)))) == nullptr)
+            return npos;
+        int32_t slot = math::slot(index);
+        if (bckt->occupied(slot))
+            return npos;
+
+        if (bckt->filled == 0)
+            revive(bckt);
+        bckt->emplace_at(slot, std::forward<Args>(args)...);
+        items_count++;
+        if (bckt->filled >= S)
+            closed(bckt);
+        if constexpr (reverse_lookup)
+            reverse.emplace(bckt->items[slot], index);
+        return index;
+    }
+
+    // Inserts a new item at a chosen index, else returns npos if the index is in use or out of range.
+    Index insert_at(Index index, const T& item) { return emplace_at(index, item); }
+    Index insert_at(Index index, T&& item) { return emplace_at(index, std::move(item)); }
+
+    /*
+        Inserts every item in [begin, end) and writes each item's index to <out> in order.
+        Free indices are filled a bucket at a time, and when the iterators are forward iterators
+        the storage for all new buckets needed is allocated in one step. Returns the advanced <out>,
+        stopping early if every index is in use.
+    */
+    template<typename It, typename Out>
+    Out insert_bulk(It begin, It end, Out out) {
+        bucket_type* bckt = nullptr;
+        auto placed = [this, &bckt, &out](int32_t slot) {
+            Index index = math::index(bckt->bucket_index, slot);
+            if constexpr (reverse_lookup)
+                reverse.emplace(bckt->items[slot], index);
+            items_count++;
+            *out++ = index;
+        };
+
+        // Fill the buckets that already have free indices first.
+        while (begin != end && (bckt = first()) != nullptr) {
+            if (bckt->filled == 0)
+                revive(bckt);
+            begin = bckt->fill(begin, end, placed);
+            if (bckt->filled >= S)
+                closed(bckt);
+        }
+
+        // Allocate all of the new buckets' storage at once when the remaining count is known.
+        if constexpr (std::is_base_of<std::forward_iterator_tag, typename std::iterator_traits<It>::iterator_category>::value) {
+            size_t need = (static_cast<size_t>(std::distance(begin, end)) + S - 1) / S;
+            if (spare.size() < need)
+                grow(std::max(need - spare.size(), slab_min));
+            buckets.reserve(buckets.size() + need);
+        }
+
+        while (begin != end && (bckt = bucket()) != nullptr) {
+            begin = bckt->fill(begin, end, placed);
+            if (bckt->filled >= S)
+                closed(bckt);
+        }
+        return out;
+    }
 
-        if (bckt == nullptr)
-            bckt = bucket();
+    /*
+        Removes the items at every index in [begin, end), skipping indices that hold no item, and
+        returns the number of items removed. The free list and bucket deallocation are updated
+        once per bucket touched rather than once per item.
+    */
+    template<typename It>
+    size_t remove_bulk(It begin, It end) {
+        std::vector<bucket_type*> touched;
+        size_t removed = 0;
+        for (; begin != end; ++begin) {
+            Index index = *begin;
+            bucket_type* bckt = locate(index);
+            if (bckt == nullptr || !bckt->occupied(math::slot(index)))
+                continue;
+            if constexpr (reverse_lookup)
+                unmap(bckt->items[math::slot(index)], index);
+            bckt->erase(math::slot(index));
+            touched.push_back(bckt);
+            removed++;
+        }
+        items_count -= removed;
 
-        return bckt->insert(item) + (bckt->bucket_index * S);
+        std::sort(touched.begin(), touched.end(), std::less<bucket_type*>());
+        touched.erase(std::unique(touched.begin(), touched.end()), touched.end());
+        for (bucket_type* bckt : touched) {
+            opened(bckt, listed(bckt));
+            if (bckt->filled <= 0)
+                vacated(bckt);
+        }
+        return removed;
     }
 
     // Removes the specified item from the index table.
-    int32_t removet(T item) {
-        // Find any bucket that contains the item as an iterator.
-        auto iter = std::find_if(buckets.begin(), buckets.end(), [&item](index_bucket<T, S>* bckt) { return bckt->item(item) != -1; });
-        if (iter == buckets.end())
-            return -1;
-        // Get the bucket from the iterator found.
-        index_bucket<T, S>* bckt = buckets[iter - buckets.begin()];
+    Index removet(const T& item) {
+        Index index = gett(item);
+        if (index == npos)
+            return npos;
 
-        // If the bucket exists then remove the item.
-        if (bckt != nullptr) {
-            int32_t index = bckt->remove(item) + (bckt->bucket_index * S);
+        take(locate(index), math::slot(index));
+        return index;
+    }
+
+    // Removes the item at the specified index from the index table and moves it out.
+    T removei(Index index) {
+        // Look up the bucket that holds the index range directly.
+        bucket_type* bckt = locate(index);
+
+        // If the bucket exists and the index is in use then remove the item.
+        if (bckt != nullptr && bckt->occupied(math::slot(index)))
+            return take(bckt, math::slot(index));
+
+        return T();
+    }
+
+    // Removes the item at the specified index and moves it out, else an empty optional. Does not require T().
+    std::optional<T> extract(Index index) {
+        bucket_type* bckt = locate(index);
+        if (bckt == nullptr || !bckt->occupied(math::slot(index)))
+            return std::nullopt;
+        return take(bckt, math::slot(index));
+    }
 
-            // If the bucket has no items, delete it.
-            if (bckt->filled <= 0) {
-                buckets.erase(iter);
-                empty.push(bckt->bucket_index);
-                delete bckt;
+    // Gets the index of the specified item.
+    Index gett(const T& item) {
+        if constexpr (reverse_lookup) {
+            auto iter = reverse.find(item);
+            return (iter != reverse.end()) ? iter->second : npos;
+        } else {
+            // Find any bucket that contains the item.
+            for (bucket_type* bckt : buckets) {
+                int32_t slot = bckt->item(item);
+                if (slot >= 0)
+                    return math::index(bckt->bucket_index, slot);
             }
+            return npos;
+        }
+    }
 
-            return index;
+    // Gets the index of the first item with the key, scanning only the bucket key arrays (split_keys option).
+    Index getk(const typename Traits::key::type& key) {
+        static_assert((Options & index_options::split_keys) != 0, "index_table::getk requires index_options::split_keys");
+        for (bucket_type* bckt : buckets) {
+            int32_t slot = bckt->key(key);
+            if (slot >= 0)
+                return math::index(bckt->bucket_index, slot);
         }
+        return npos;
+    }
 
-        return -1;
+    // Inserts a new item into the index table and returns a handle to it (generations option).
+    handle inserth(T item) {
+        return geth(insert(std::move(item)));
     }
 
-    // Removes the item at the specified index from the index table.
-    T removei(int32_t index) {
-        // Find any bucket that contains the item as an iterator.
-        auto iter = std::find_if(buckets.begin(), buckets.end(), [&index](index_bucket<T, S>* bck) { return bck->bucket_index == (index / S); });
-        if (iter == buckets.end())
-            return T();
-        // Get the bucket from the iterator found.
-        index_bucket<T, S>* bckt = buckets[iter - buckets.begin()];
-        
-        // If the bucket exists then remove the item.
-        if (bckt != nullptr) {
-            T item = bckt->items[index % S];
-            bckt->remove(item);
+    // Gets a handle to the item at the specified index, else a handle with index npos (generations option).
+    handle geth(Index index) {
+        static_assert(generations, "index_table::geth requires index_options::generations");
+        bucket_type* bckt = locate(index);
+        if (bckt == nullptr || !bckt->occupied(math::slot(index)))
+            return handle();
+        return handle{ index, bckt->generation[math::slot(index)] };
+    }
 
-            // If the bucket has no items, delete it.
-            if (bckt->filled <= 0) {
-                buckets.erase(iter);
-                empty.push(bckt->bucket_index);
-                delete bckt;
-            }
+    // Gets the item the handle refers to, else an empty optional if its index was removed or re-used (generations option).
+    std::optional<T> geti(handle hndl) {
+        static_assert(generations, "index_table::geti(handle) requires index_options::generations");
+        bucket_type* bckt = locate(hndl.index);
+        if (bckt == nullptr || !bckt->occupied(math::slot(hndl.index)) || bckt->generation[math::slot(hndl.index)] != hndl.generation)
+            return std::nullopt;
+        return bckt->items[math::slot(hndl.index)];
+    }
+
+    // Removes the item the handle refers to, else returns an empty optional if its index was removed or re-used (generations option).
+    std::optional<T> removei(handle hndl) {
+        static_assert(generations, "index_table::removei(handle) requires index_options::generations");
+        bucket_type* bckt = locate(hndl.index);
+        if (bckt == nullptr || !bckt->occupied(math::slot(hndl.index)) || bckt->generation[math::slot(hndl.index)] != hndl.generation)
+            return std::nullopt;
+        return take(bckt, math::slot(hndl.index));
+    }
 
-            return item;
+    // Iterates the occupied indices of the table in bucket index order.
+    iterator begin() { return iterator(&directory, false); }
+    iterator end() { return iterator(&directory, true); }
+    const_iterator begin() const { return const_iterator(&directory, false); }
+    const_iterator end() const { return const_iterator(&directory, true); }
+
+    // Calls f(index, item) for every item in bucket index order, the fastest way to visit all items.
+    template<typename F>
+    void for_each(F&& f) {
+        for (size_t i = directory.next(0); i < directory.size(); i = directory.next(i + 1)) {
+            bucket_type* bckt = directory[i];
+            Index base = math::index(bckt->bucket_index, 0);
+            for (size_t w = 0; w < bckt->words; w++) {
+                for (uint64_t bits = bckt->occupancy[w]; bits != 0; bits &= bits - 1) {
+                    int32_t slot = static_cast<int32_t>(w * 64) + index_ctz(bits);
+                    f(base + slot, bckt->items[slot]);
+                }
+            }
         }
+    }
 
-        return T();
+    /*
+        Looks up <count> indices at once, writing a pointer to each item to <out> (nullptr where
+        the index holds no item). Indices are resolved in blocks of <lookahead>: the directory
+        entries of the next block are prefetched, and the buckets of the current block are looked
+        up with their header and item lines prefetched before any item is checked, so the cache
+        misses of a random batch overlap instead of being taken one index at a time.
+    */
+    void geti_many(const Index* indices, size_t count, T** out) {
+        bucket_type* found[lookahead];
+        for (size_t begin = 0; begin < count; begin += lookahead) {
+            size_t block = std::min(lookahead, count - begin);
+            // Start loading the next block's directory entries while this block's buckets are read.
+            for (size_t j = begin + block; j < std::min(count, begin + block + lookahead); j++) {
+                size_t bindex = static_cast<size_t>(math::bucket(indices[j]));
+                if ((!std::is_signed<Index>::value || indices[j] >= 0) && bindex < directory.size())
+                    directory.prefetch(bindex);
+            }
+            for (size_t j = 0; j < block; j++) {
+                Index index = indices[begin + j];
+                found[j] = locate(index);
+                if (found[j] != nullptr) {
+                    index_prefetch(&found[j]->occupancy[math::slot(index) / 64]);
+                    index_prefetch(&found[j]->items[math::slot(index)]);
+                }
+            }
+            for (size_t j = 0; j < block; j++) {
+                int32_t slot = math::slot(indices[begin + j]);
+                out[begin + j] = (found[j] != nullptr && found[j]->occupied(slot)) ? &found[j]->items[slot] : nullptr;
+            }
+        }
     }
 
-    // Gets the index of the specified item.
-    int32_t gett(T item) {
-        // Find any bucket that contains the item as an iterator.
-        auto iter = std::find_if(buckets.begin(), buckets.end(), [&item](index_bucket<T, S>* bckt) { return bckt->item(item) != -1; });
-        if (iter == buckets.end())
-            return -1;
-        // Get the bucket from the iterator found.
-        index_bucket<T, S>* bckt = buckets[iter - buckets.begin()];
-        return bckt->item(item) + (bckt->bucket_index * S);
+    // Gets a pointer to the item at the specified index without copying it, else nullptr.
+    T* find(Index index) {
+        bucket_type* bckt = locate(index);
+        if (bckt == nullptr || !bckt->occupied(math::slot(index)))
+            return nullptr;
+        return &bckt->items[math::slot(index)];
     }
 
     // Gets the item at the specified index.
-    T geti(int32_t index) {
-        auto iter = std::find_if(buckets.begin(), buckets.end(), [&index](index_bucket<T, S>* bck) { return bck->bucket_index == (index / S); });
-        if (iter == buckets.end())
+    T geti(Index index) {
+        // Look up the bucket that holds the index range directly.
+        bucket_type* bckt = locate(index);
+        if (bckt == nullptr || !bckt->occupied(math::slot(index)))
             return T();
-        // Get the bucket from the iterator found.
-        index_bucket<T, S>* bckt = buckets[iter - buckets.begin()];
-        return bckt->items[index % S];
+        return bckt->items[math::slot(index)];
+    }
+};
+
+/*
+    Read-only view of a snapshot written by index_table::save, for example a file mapped into
+    memory with mmap. Lookups read items in place through the snapshot's directory, so opening a
+    view is O(1) instead of deserializing every bucket. The memory must stay mapped and unchanged
+    while the view is used, and must be aligned to alignof(T) (mapped pages always are).
+*/
+template<typename T, size_t S, typename Index = int32_t>
+class index_table_view {
+    static_assert(std::is_trivially_copyable<T>::value, "index_table_view requires a trivially copyable T");
+    using layout = index_snapshot_layout<T, S>;
+    using math = index_math<S>;
+
+    const char* data = nullptr;
+    // First record in the snapshot.
+    const char* records = nullptr;
+    index_snapshot_header header = {};
+    size_t record_size = 0;
+
+    // Returns the record for the bucket index, else nullptr when the snapshot holds no such bucket.
+    // The page is found by a binary search of the sorted page table, so sparse snapshots need no entry per range.
+    const char* record(uint64_t bindex) const {
+        if (bindex >= header.directory)
+            return nullptr;
+        uint64_t lo = 0, hi = header.pages, page, number;
+        while (lo < hi) {
+            uint64_t mid = lo + (hi - lo) / 2;
+            std::memcpy(&page, data + sizeof(header) + sizeof(uint64_t) * mid, sizeof(page));
+            if (page < bindex / layout::page)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        if (lo >= header.pages)
+            return nullptr;
+        std::memcpy(&page, data + sizeof(header) + sizeof(uint64_t) * lo, sizeof(page));
+        if (page != bindex / layout::page)
+            return nullptr;
+        std::memcpy(&number, data + layout::pages(header.pages) + sizeof(uint64_t) * (lo * layout::page + bindex % layout::page), sizeof(number));
+        return (number < header.records) ? records + record_size * number : nullptr;
+    }
+
+    // Returns whether the slot of the record holds an item.
+    static bool occupied(const char* rec, int32_t slot) {
+        uint64_t word;
+        std::memcpy(&word, rec + sizeof(uint64_t) * (1 + slot / 64), sizeof(word));
+        return (word >> (slot % 64)) & 1;
+    }
+
+    public:
+    static constexpr Index npos = static_cast<Index>(-1);
+
+    index_table_view() = default;
+
+    // Opens a snapshot of <size> bytes, leaving the view invalid if it was not saved by an index_table<T, S, *, Index>.
+    index_table_view(const void* snapshot, size_t size) {
+        if (snapshot == nullptr || size < sizeof(header) || reinterpret_cast<uintptr_t>(snapshot) % alignof(T) != 0)
+            return;
+        std::memcpy(&header, snapshot, sizeof(header));
+        if (std::memcmp(header.magic, index_snapshot_header::signature, sizeof(header.magic)) != 0 || header.version != index_snapshot_header::current
+            || header.item_size != sizeof(T) || header.item_align != alignof(T) || header.bucket_size != S || header.index_size != sizeof(Index)
+            || header.records > header.directory || header.pages > header.records)
+            return;
+        record_size = layout::record((header.flags & index_options::generations) != 0);
+        // extent() is overflow checked, so a crafted header cannot wrap the size check.
+        if (layout::extent(header) > size)
+            return;
+        data = static_cast<const char*>(snapshot);
+        records = data + layout::records(header.pages);
+    }
+
+    // Returns whether the view holds a valid snapshot.
+    bool valid() const { return data != nullptr; }
+
+    // Returns the number of items in the snapshot.
+    size_t count() const { return static_cast<size_t>(header.items); }
+
+    // Returns the number of buckets in the snapshot.
+    size_t bucket_count() const { return static_cast<size_t>(header.records); }
+
+    // Gets a pointer to the item at the specified index inside the snapshot, else nullptr.
+    const T* find(Index index) const {
+        if constexpr (std::is_signed<Index>::value) {
+            if (index < 0)
+                return nullptr;
+        }
+        const char* rec = (data != nullptr) ? record(static_cast<uint64_t>(math::bucket(index))) : nullptr;
+        if (rec == nullptr || !occupied(rec, math::slot(index)))
+            return nullptr;
+        return reinterpret_cast<const T*>(rec + layout::items + sizeof(T) * math::slot(index));
+    }
+
+    // Gets the item at the specified index, else T().
+    T geti(Index index) const {
+        const T* item = find(index);
+        return (item != nullptr) ? *item : T();
+    }
+
+    // Calls f(index, item) for every item in bucket index order.
+    template<typename F>
+    void for_each(F&& f) const {
+        for (uint64_t r = 0; data != nullptr && r < header.records; r++) {
+            const char* rec = records + record_size * r;
+            uint64_t bindex;
+            std::memcpy(&bindex, rec, sizeof(bindex));
+            Index base = math::index(static_cast<Index>(bindex), 0);
+            for (size_t w = 0; w < layout::words; w++) {
+                uint64_t word;
+                std::memcpy(&word, rec + sizeof(uint64_t) * (1 + w), sizeof(word));
+                for (; word != 0; word &= word - 1) {
+                    int32_t slot = static_cast<int32_t>(w * 64) + index_ctz(word);
+                    f(base + slot, *reinterpret_cast<const T*>(rec + layout::items + sizeof(T) * slot));
+                }
+            }
+        }
     }
 };
 
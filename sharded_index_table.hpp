@@ -0,0 +1,200 @@
+#ifndef SHARDED_INDEX_TABLE
+#define SHARDED_INDEX_TABLE
+/*
+    Sharded variant of index_table for multi-core scaling with plain locks.
+
+    The table wraps N independent index_tables, each behind its own mutex on its own cache
+    lines. The shard an item lives in is encoded in the low bits of its index, so geti/removei
+    go straight to the right shard without a lookup. Inserts go to the calling thread's home
+    shard (handed out round-robin to threads on their first insert) and only fall back to another
+    shard when the home shard is locked, so threads inserting at the same time rarely touch the
+    same lock. There is no limit on the number of threads.
+
+    Indices of each shard are shifted up by log2(N) bits, so each shard can hold 1/N of the
+    indices Index can represent.
+*/
+#include "index_table.hpp"
+#include <atomic>
+#include <mutex>
+
+/*
+    T: Type of data you want to store.
+    S: Size of each bucket's cache for storing items.
+    N: Number of shards, a power of two.
+    Options: index_options flags of every shard's index_table.
+    Index: Integer type of the indices, see index_table.
+    Alloc: Allocator of every shard's index_table, default-constructed once per shard.
+    Traits: index_traits of every shard's index_table.
+*/
+template<typename T, size_t S, size_t N, unsigned Options = 0, typename Index = int32_t, typename Alloc = std::allocator<T>, typename Traits = index_traits<T>>
+class sharded_index_table {
+    static_assert(N > 0 && (N & (N - 1)) == 0, "sharded_index_table requires a power of two number of shards N");
+
+    public:
+    using table_type = index_table<T, S, Options, Index, Alloc, Traits>;
+    static constexpr Index npos = table_type::npos;
+    // Number of low index bits holding the shard.
+    static constexpr int32_t shard_bits = index_log2(N);
+
+    private:
+    struct alignas(64) shard {
+        std::mutex lock;
+        table_type table;
+        // Each shard stops handing out indices past max_local, so every local index has a global one.
+        shard() : table(0) { table.limit(max_local); }
+    };
+    shard shards[N];
+
+    // Highest shard-local index whose global index fits in Index without reaching npos.
+    static constexpr Index max_local = static_cast<Index>((std::numeric_limits<Index>::max() >> shard_bits) - (std::is_signed<Index>::value ? 0 : 1));
+    static_assert(static_cast<size_t>(max_local) >= S - 1, "sharded_index_table requires an Index wide enough for at least one bucket of S indices per shard");
+
+    // Returns whether the index could have been returned by this table.
+    static bool valid(Index index) {
+        if constexpr (std::is_signed<Index>::value) {
+            if (index < 0)
+                return false;
+        }
+        return index != npos;
+    }
+
+    // Returns the global index of a shard-local index, else npos when it does not fit.
+    static Index global(size_t at, Index local) {
+        if (local == npos || local > max_local)
+            return npos;
+        return static_cast<Index>((local << shard_bits) | static_cast<Index>(at));
+    }
+
+
+    public:
+    sharded_index_table() = default;
+    sharded_index_table(const sharded_index_table&) = delete;
+    sharded_index_table& operator=(const sharded_index_table&) = delete;
+
+    // Returns the shard holding the index.
+    static size_t shard_of(Index index) { return static_cast<size_t>(index) & (N - 1); }
+
+    // Returns the index within its shard.
+    static Index local_of(Index index) { return index >> shard_bits; }
+
+    // Returns the calling thread's home shard for inserts.
+    static size_t home() {
+        static std::atomic<size_t> threads{ 0 };
+        thread_local size_t self = threads.fetch_add(1, std::memory_order_relaxed);
+        return self & (N - 1);
+    }
+
+    /*
+        Constructs a new item in place in the home shard, else in the next unlocked shard when the
+        home shard is busy or full. Only when every unlocked shard is full does it wait for the
+        busy ones. Returns npos once all shards are full.
+    */
+    template<typename... Args>
+    Index emplace(Args&&... args) {
+        size_t at = home();
+        // A full shard returns npos before constructing the item, so the arguments are still intact for the next shard.
+        for (int wait = 0; wait < 2; wait++) {
+            for (size_t i = 0; i < N; i++) {
+                size_t next = (at + i) & (N - 1);
+                std::unique_lock<std::mutex> held(shards[next].lock, std::defer_lock);
+                if (wait)
+                    held.lock();
+                else if (!held.try_lock())
+                    continue;
+                Index local = shards[next].table.emplace(std::forward<Args>(args)...);
+                if (local != npos)
+                    return global(next, local);
+            }
+        }
+        return npos;
+    }
+
+    // Inserts a new item into the table.
+    Index insert(const T& item) { return emplace(item); }
+    Index insert(T&& item) { return emplace(std::move(item)); }
+
+    // Inserts a new item into the shard chosen by <hint> (taken modulo N), waiting for its lock. Returns npos if that shard is full.
+    Index insert_hint(size_t hint, const T& item) {
+        size_t at = hint & (N - 1);
+        std::lock_guard<std::mutex> held(shards[at].lock);
+        return global(at, shards[at].table.insert(item));
+    }
+
+    // Removes the specified item from the table.
+    Index removet(const T& item) {
+        for (size_t at = 0; at < N; at++) {
+            std::lock_guard<std::mutex> held(shards[at].lock);
+            Index local = shards[at].table.removet(item);
+            if (local != npos)
+                return global(at, local);
+        }
+        return npos;
+    }
+
+    // Removes the item at the specified index from the table and moves it out, else T().
+    T removei(Index index) {
+        if (!valid(index))
+            return T();
+        shard& owner = shards[shard_of(index)];
+        std::lock_guard<std::mutex> held(owner.lock);
+        return owner.table.removei(local_of(index));
+    }
+
+    // Removes the item at the specified index and moves it out, else an empty optional.
+    std::optional<T> extract(Index index) {
+        if (!valid(index))
+            return std::nullopt;
+        shard& owner = shards[shard_of(index)];
+        std::lock_guard<std::mutex> held(owner.lock);
+        return owner.table.extract(local_of(index));
+    }
+
+    // Gets the index of the specified item, searching the shards in order.
+    Index gett(const T& item) {
+        for (size_t at = 0; at < N; at++) {
+            std::lock_guard<std::mutex> held(shards[at].lock);
+            Index local = shards[at].table.gett(item);
+            if (local != npos)
+                return global(at, local);
+        }
+        return npos;
+    }
+
+    // Gets the item at the specified index, else T().
+    T geti(Index index) {
+        if (!valid(index))
+            return T();
+        shard& owner = shards[shard_of(index)];
+        std::lock_guard<std::mutex> held(owner.lock);
+        return owner.table.geti(local_of(index));
+    }
+
+    // Returns the number of items in all shards. Shards are counted one at a time, so concurrent updates may be partly seen.
+    size_t count() {
+        size_t total = 0;
+        for (size_t at = 0; at < N; at++) {
+            std::lock_guard<std::mutex> held(shards[at].lock);
+            total += shards[at].table.count();
+        }
+        return total;
+    }
+
+    // Calls f(index, item) for every item, one shard at a time while holding that shard's lock.
+    template<typename F>
+    void for_each(F&& f) {
+        for (size_t at = 0; at < N; at++) {
+            std::lock_guard<std::mutex> held(shards[at].lock);
+            shards[at].table.for_each([&f, at](Index local, T& item) { f(global(at, local), item); });
+        }
+    }
+
+    // Calls f(table) on shard <at> (taken modulo N) under its lock, for operations not forwarded here.
+    template<typename F>
+    auto with_shard(size_t at, F&& f) -> decltype(f(std::declval<table_type&>())) {
+        shard& owner = shards[at & (N - 1)];
+        std::lock_guard<std::mutex> held(owner.lock);
+        return f(owner.table);
+    }
+};
+
+#endif
@@ -0,0 +1,205 @@
+#include "concurrent_index_table.hpp"
+#include "sharded_index_table.hpp"
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <thread>
+#include <vector>
+
+/*
+    Multi-threaded stress test for concurrent_index_table and sharded_index_table.
+
+    Every thread inserts items of its own (unique non-zero values), checks them with geti, and
+    removes them again with removei or removet. Some items are handed to other threads through a
+    mailbox and removed by the thread that claims them. Every index is recorded in an ownership
+    table when it is handed out and cleared by its owner before it is removed, so an index handed
+    out twice fails the record. At the end the table must hold exactly the items still live, each
+    once, and be empty after they are removed.
+
+    Usage: index_table_stress [threads] [operations per thread]
+*/
+
+// Largest index the ownership table records.
+static constexpr size_t stress_indices = size_t(1) << 22;
+// Number of items handed between threads at once.
+static constexpr size_t stress_mailbox = 64;
+
+static std::atomic<long> failures{ 0 };
+
+static void fail(const char* what, long at, uint64_t item) {
+    if (failures.fetch_add(1) < 20)
+        fprintf(stderr, "  %s: index %ld item %llx\n", what, at, static_cast<unsigned long long>(item));
+}
+
+// An item inserted by a thread, with the index the table returned.
+struct stress_entry {
+    int32_t index;
+    uint64_t item;
+};
+
+template<typename Table>
+class stress {
+    Table& table;
+    std::vector<std::atomic<uint64_t>> owner;
+    // Items handed to other threads, nullptr where empty. An entry is claimed by exchanging it with nullptr.
+    std::atomic<stress_entry*> mailbox[stress_mailbox];
+
+    // Records the index as holding the item, fails if another item holds it.
+    void own(int32_t index, uint64_t item) {
+        if (index < 0 || static_cast<size_t>(index) >= stress_indices) {
+            fail("index out of range", index, item);
+            return;
+        }
+        uint64_t expected = 0;
+        if (!owner[index].compare_exchange_strong(expected, item))
+            fail("index handed out twice", index, item);
+    }
+
+    // Clears the record of an index its owner is about to remove.
+    void disown(int32_t index, uint64_t item) {
+        uint64_t expected = item;
+        if (!owner[index].compare_exchange_strong(expected, 0))
+            fail("index record lost", index, item);
+    }
+
+    // Removes an owned item by index or by item.
+    void remove(const stress_entry& entry, bool by_item) {
+        disown(entry.index, entry.item);
+        if (by_item) {
+            int32_t index = table.removet(entry.item);
+            if (index != entry.index)
+                fail("removet returned the wrong index", index, entry.item);
+        } else {
+            uint64_t item = table.removei(entry.index);
+            if (item != entry.item)
+                fail("removei returned the wrong item", entry.index, item);
+        }
+    }
+
+    public:
+    stress(Table& table) : table(table), owner(stress_indices) {
+        for (auto& slot : mailbox)
+            slot.store(nullptr);
+    }
+
+    // Runs <ops> random operations on thread <id> and returns the items it still owns.
+    std::vector<stress_entry> run(int id, long ops) {
+        std::mt19937_64 rng(id + 1);
+        std::vector<stress_entry> live;
+        uint64_t next = 0;
+        for (long op = 0; op < ops; op++) {
+            unsigned pick = rng() % 16;
+            if (live.size() < 64 || pick < 6) {
+                stress_entry entry;
+                entry.item = (uint64_t(id + 1) << 40) | ++next;
+                entry.index = table.insert(entry.item);
+                own(entry.index, entry.item);
+                live.push_back(entry);
+            } else if (pick < 9) {
+                size_t at = rng() % live.size();
+                remove(live[at], false);
+                live[at] = live.back();
+                live.pop_back();
+            } else if (pick < 11) {
+                size_t at = rng() % live.size();
+                remove(live[at], true);
+                live[at] = live.back();
+                live.pop_back();
+            } else if (pick < 12) {
+                // Hand an item to whichever thread claims it, unless the slot is taken.
+                size_t at = rng() % live.size();
+                stress_entry* handed = new stress_entry(live[at]);
+                stress_entry* expected = nullptr;
+                if (mailbox[rng() % stress_mailbox].compare_exchange_strong(expected, handed)) {
+                    live[at] = live.back();
+                    live.pop_back();
+                } else {
+                    delete handed;
+                }
+            } else if (pick < 13) {
+                // Claim an item another thread handed over, it is removed by this thread from now on.
+                stress_entry* handed = mailbox[rng() % stress_mailbox].exchange(nullptr);
+                if (handed != nullptr) {
+                    live.push_back(*handed);
+                    delete handed;
+                }
+            } else {
+                const stress_entry& entry = live[rng() % live.size()];
+                uint64_t item = table.geti(entry.index);
+                if (item != entry.item)
+                    fail("geti returned the wrong item", entry.index, item);
+            }
+        }
+        return live;
+    }
+
+    // Collects the items still in the mailbox.
+    void drain(std::vector<stress_entry>& live) {
+        for (auto& slot : mailbox) {
+            stress_entry* handed = slot.exchange(nullptr);
+            if (handed != nullptr) {
+                live.push_back(*handed);
+                delete handed;
+            }
+        }
+    }
+
+    // Checks the table holds exactly the live items, then removes them.
+    void verify(std::vector<stress_entry>& live) {
+        if (table.count() != live.size())
+            fail("count differs from the live items", static_cast<long>(table.count()), live.size());
+        size_t seen = 0;
+        auto check = [&](int32_t index, uint64_t item) {
+            seen++;
+            if (index < 0 || static_cast<size_t>(index) >= stress_indices || owner[index].load() != item)
+                fail("iteration found an item it does not own", index, item);
+        };
+        for_each(table, check);
+        if (seen != live.size())
+            fail("iteration count differs from the live items", static_cast<long>(seen), live.size());
+        for (const stress_entry& entry : live)
+            remove(entry, false);
+        if (table.count() != 0)
+            fail("items left after removing every item", static_cast<long>(table.count()), 0);
+    }
+
+    template<typename F>
+    static void for_each(concurrent_index_table<uint64_t, 64>& table, F&& f) { table.view().for_each(f); }
+
+    template<typename F, size_t S, size_t N>
+    static void for_each(sharded_index_table<uint64_t, S, N>& table, F&& f) {
+        table.for_each([&f](int32_t index, uint64_t& item) { f(index, item); });
+    }
+};
+
+template<typename Table>
+static void run(const char* name, Table& table, int threads, long ops) {
+    long before = failures.load();
+    stress<Table>* test = new stress<Table>(table);
+    std::vector<std::vector<stress_entry>> live(threads);
+    std::vector<std::thread> workers;
+    for (int id = 0; id < threads; id++)
+        workers.emplace_back([&, id] { live[id] = test->run(id, ops); });
+    for (auto& worker : workers)
+        worker.join();
+
+    std::vector<stress_entry> all;
+    for (auto& part : live)
+        all.insert(all.end(), part.begin(), part.end());
+    test->drain(all);
+    test->verify(all);
+    delete test;
+    printf("%s: %s\n", name, (failures.load() == before) ? "ok" : "FAILED");
+}
+
+int main(int argc, char** argv) {
+    int threads = (argc > 1) ? std::atoi(argv[1]) : 4;
+    long ops = (argc > 2) ? std::atol(argv[2]) : 200000;
+
+    concurrent_index_table<uint64_t, 64> concurrent(0);
+    run("concurrent_index_table", concurrent, threads, ops);
+    sharded_index_table<uint64_t, 64, 4> sharded;
+    run("sharded_index_table", sharded, threads, ops);
+    return (failures.load() == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}